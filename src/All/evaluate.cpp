@@ -31,9 +31,6 @@
 #include "thread.h"
 #include "uci.h"
 
-//from Shashin
-extern bool pawnsPiecesToEvaluate, passedPawnsToEvaluate,initiativeToEvaluate;
-//end from Shashin
 //from Corchess
 extern int lessPruningMode;
 //end from Corchess
@@ -102,6 +99,14 @@ namespace {
   constexpr Value LazyThreshold  = Value(1500);
   constexpr Value SpaceThreshold = Value(12222);
 
+  // Margins of the terms left after each stage of the staged evaluation: all
+  // the piece terms in an endgame without queens and passed pawns, then the
+  // threats, space and initiative when no passed pawn is scored. The largest
+  // changes measured by the 'evalcheck' command on the bench positions and
+  // tests/HardPositions, for every set of features and Shashin weights, are
+  // 929 and 821 cp.
+  constexpr Value LazyMargin[] = { Value(1100), Value(1000) };
+
   // KingAttackWeights[PieceType] contains king attack weights by piece type
   constexpr int KingAttackWeights[PIECE_TYPE_NB] = { 0, 0, 77, 55, 44, 10 };
 
@@ -182,15 +187,18 @@ namespace {
 
 #undef S
 
-  // Evaluation class computes and stores attacks tables and other working data
-  template<Tracing T>
+  // Evaluation class computes and stores attacks tables and other working data.
+  // F is the set of Eval::Features terms it evaluates.
+  template<Tracing T, int F = Eval::ALL_FEATURES>
   class Evaluation {
 
   public:
     Evaluation() = delete;
-    explicit Evaluation(const Position& p) : pos(p) {}
+    explicit Evaluation(const Position& p, Value a = -VALUE_INFINITE, Value b = VALUE_INFINITE)
+      : pos(p), alpha(a), beta(b) {}
     Evaluation& operator=(const Evaluation&) = delete;
     Value value();
+    bool cut() const { return lazyCut; }
 
   private:
     template<Color Us> void initialize();
@@ -201,8 +209,12 @@ namespace {
     template<Color Us> Score space() const;
     ScaleFactor scale_factor(Value eg) const;
     Score initiative(Value eg) const;
+    Value interpolate(Score score) const;
+    bool lazy_cut(Score score, int stage, Value& bound);
 
     const Position& pos;
+    Value alpha, beta;
+    bool lazyCut = false;
     Material::Entry* me;
     Pawns::Entry* pe;
     Bitboard mobilityArea[COLOR_NB];
@@ -245,8 +257,8 @@ namespace {
 
   // Evaluation::initialize() computes king and pawn attacks, and the king ring
   // bitboard for a given color. This is done at the beginning of the evaluation.
-  template<Tracing T> template<Color Us>
-  void Evaluation<T>::initialize() {
+  template<Tracing T, int F> template<Color Us>
+  void Evaluation<T, F>::initialize() {
 
     constexpr Color     Them = (Us == WHITE ? BLACK : WHITE);
     constexpr Direction Up   = (Us == WHITE ? NORTH : SOUTH);
@@ -288,8 +300,8 @@ namespace {
 
 
   // Evaluation::pieces() scores pieces of a given color and type
-  template<Tracing T> template<Color Us, PieceType Pt>
-  Score Evaluation<T>::pieces() {
+  template<Tracing T, int F> template<Color Us, PieceType Pt>
+  Score Evaluation<T, F>::pieces() {
 
     constexpr Color     Them = (Us == WHITE ? BLACK : WHITE);
     constexpr Direction Down = (Us == WHITE ? SOUTH : NORTH);
@@ -410,8 +422,8 @@ namespace {
 
 
   // Evaluation::king() assigns bonuses and penalties to a king of a given color
-  template<Tracing T> template<Color Us>
-  Score Evaluation<T>::king() const {
+  template<Tracing T, int F> template<Color Us>
+  Score Evaluation<T, F>::king() const {
 
     constexpr Color    Them = (Us == WHITE ? BLACK : WHITE);
     constexpr Bitboard Camp = (Us == WHITE ? AllSquares ^ Rank6BB ^ Rank7BB ^ Rank8BB
@@ -528,8 +540,8 @@ namespace {
 
   // Evaluation::threats() assigns bonuses according to the types of the
   // attacking and the attacked pieces.
-  template<Tracing T> template<Color Us>
-  Score Evaluation<T>::threats() const {
+  template<Tracing T, int F> template<Color Us>
+  Score Evaluation<T, F>::threats() const {
 
     constexpr Color     Them     = (Us == WHITE ? BLACK   : WHITE);
     constexpr Direction Up       = (Us == WHITE ? NORTH   : SOUTH);
@@ -637,8 +649,8 @@ namespace {
   // Evaluation::passed() evaluates the passed pawns and candidate passed
   // pawns of the given color.
 
-  template<Tracing T> template<Color Us>
-  Score Evaluation<T>::passed() const {
+  template<Tracing T, int F> template<Color Us>
+  Score Evaluation<T, F>::passed() const {
 
     constexpr Color     Them = (Us == WHITE ? BLACK : WHITE);
     constexpr Direction Up   = (Us == WHITE ? NORTH : SOUTH);
@@ -730,8 +742,8 @@ namespace {
   // twice. Finally, the space bonus is multiplied by a weight. The aim is to
   // improve play on game opening.
 
-  template<Tracing T> template<Color Us>
-  Score Evaluation<T>::space() const {
+  template<Tracing T, int F> template<Color Us>
+  Score Evaluation<T, F>::space() const {
 
     if (pos.non_pawn_material() < SpaceThreshold)
         return SCORE_ZERO;
@@ -769,8 +781,8 @@ namespace {
   // for the position. It is a second order bonus/malus based on the
   // known attacking/defending status of the players.
 
-  template<Tracing T>
-  Score Evaluation<T>::initiative(Value eg) const {
+  template<Tracing T, int F>
+  Score Evaluation<T, F>::initiative(Value eg) const {
 
     int outflanking =  distance<File>(pos.square<KING>(WHITE), pos.square<KING>(BLACK))
                      - distance<Rank>(pos.square<KING>(WHITE), pos.square<KING>(BLACK));
@@ -800,8 +812,8 @@ namespace {
 
   // Evaluation::scale_factor() computes the scale factor for the winning side
 
-  template<Tracing T>
-  ScaleFactor Evaluation<T>::scale_factor(Value eg) const {
+  template<Tracing T, int F>
+  ScaleFactor Evaluation<T, F>::scale_factor(Value eg) const {
 
     Color strongSide = eg > VALUE_DRAW ? WHITE : BLACK;
     int sf = me->scale_factor(pos, strongSide);
@@ -820,6 +832,47 @@ namespace {
 
     return ScaleFactor(sf);
   }
+
+  // Evaluation::interpolate() interpolates between a middlegame and a (scaled by
+  // 'sf') endgame score, from the white point of view
+
+  template<Tracing T, int F>
+  Value Evaluation<T, F>::interpolate(Score score) const {
+
+    ScaleFactor sf = scale_factor(eg_value(score));
+    Value v =  mg_value(score) * int(me->game_phase())
+             + eg_value(score) * int(PHASE_MIDGAME - me->game_phase()) * sf / SCALE_FACTOR_NORMAL;
+
+    return v / PHASE_MIDGAME;
+  }
+
+
+  // Evaluation::lazy_cut() checks, at the end of a stage, whether the score so
+  // far is so far outside the (alpha, beta) window that the remaining terms
+  // cannot bring it back inside. Then the evaluation can stop with the bound
+  // the final value is known to pass, from the side to move point of view.
+
+  template<Tracing T, int F>
+  bool Evaluation<T, F>::lazy_cut(Score score, int stage, Value& bound) {
+
+    if (alpha == -VALUE_INFINITE && beta == VALUE_INFINITE)
+        return false;
+
+    Value v = interpolate(score);
+    v = (pos.side_to_move() == WHITE ? v : -v) + Eval::Tempo;
+
+    if (v - LazyMargin[stage] >= beta)
+        bound = v - LazyMargin[stage];
+
+    else if (v + LazyMargin[stage] <= alpha)
+        bound = v + LazyMargin[stage];
+
+    else
+        return false;
+
+    return lazyCut = true;
+  }
+
   //from shashin
   inline void setWeightsByShashinValue(uint8_t shashinValue) {
     if ((shashinValue == SHASHIN_POSITION_CAPABLANCA_PETROSIAN) || (shashinValue == SHASHIN_POSITION_TAL_CAPABLANCA)){
@@ -864,8 +917,8 @@ namespace {
   // parts of the evaluation and returns the value of the position from the point
   // of view of the side to move.
 
-  template<Tracing T>
-  Value Evaluation<T>::value() {
+  template<Tracing T, int F>
+  Value Evaluation<T, F>::value() {
 
     assert(!pos.checkers());
     setWeightsByShashinValue(pos.this_thread()->shashinValue); //from shashin
@@ -885,7 +938,7 @@ namespace {
     // Probe the pawn hash table
     pe = Pawns::probe(pos);
     Score peScore=apply_weight(pe->pawn_score(WHITE) - pe->pawn_score(BLACK),weightsMG[PAWN_STRUCTURE_POS],weightsEG[PAWN_STRUCTURE_POS]);
-    if (pawnsPiecesToEvaluate){
+    if (F & Eval::PAWNS_PIECES) {
 	score += peScore;
     }
     //end from Shashin
@@ -898,6 +951,16 @@ namespace {
 	 return pos.side_to_move() == WHITE ? v : -v;
     }
     //end from Corchess
+
+    // First stage, before the pieces, king safety and threats. With queens or
+    // passed pawns the king safety or the passed pawns alone may change the
+    // score by more than any useful margin, so only quiet endgames can stop.
+    Value bound;
+    if (   !pos.count<QUEEN>()
+        && !pe->passed_count()
+        &&  lazy_cut(score, 0, bound))
+        return bound;
+
     // Main evaluation begins here
 
     initialize<WHITE>();
@@ -909,7 +972,7 @@ namespace {
 				      + pieces<WHITE, BISHOP>() - pieces<BLACK, BISHOP>()
 				      + pieces<WHITE, ROOK  >() - pieces<BLACK, ROOK  >()
 				      + pieces<WHITE, QUEEN >() - pieces<BLACK, QUEEN >(),weightsMG[PIECES_POS],weightsEG[PIECES_POS]);
-    if(pawnsPiecesToEvaluate){
+    if (F & Eval::PAWNS_PIECES) {
       score +=  piecesScore;
     }
     //Shashin compact advance patch begin
@@ -930,28 +993,32 @@ namespace {
     Score score_king = Score(int(double(default_king) * king_dynamic_scale));
     score +=  apply_weight(score_king,weightsMG[KING_SAFETY_POS],weightsEG[KING_SAFETY_POS]); //from Sugar
     //Shashin compact advance patch end
+
+    // Second stage, before the threats and passed pawns. The passed pawns alone
+    // may change the score by more than 2500 cp, so when they are evaluated
+    // only the positions without any can stop.
+    if (   (!(F & Eval::PASSED_PAWNS) || !pe->passed_count())
+        &&  lazy_cut(score, 1, bound))
+        return bound;
+
     score += apply_weight(threats<WHITE>() - threats<BLACK>(),weightsMG[THREATS_POS],weightsEG[THREATS_POS]);
     //Shashin compact advance patch begin
     Score default_passed = passed< WHITE>() - passed< BLACK>();
     Score score_passed = Score(int(double(default_passed) * passed_dynamic_scale));
     Score passedScore=apply_weight(score_passed,weightsMG[PASSED_PAWNS_POS],weightsEG[PASSED_PAWNS_POS]);
     //Shashin compact advance patch end
-    if(passedPawnsToEvaluate)
+    if (F & Eval::PASSED_PAWNS)
     {
       score += passedScore;
     }
     score += apply_weight(space<  WHITE>() - space<  BLACK>(),weightsMG[SPACE_POS],weightsEG[SPACE_POS]);
     Score initiativeScore=apply_weight(initiative(eg_value(score)),weightsMG[INITIATIVE_POS],weightsEG[INITIATIVE_POS]);
-    if(initiativeToEvaluate){
+    if (F & Eval::INITIATIVE) {
       score +=initiativeScore;
     }
     //end from Shashin
     // Interpolate between a middlegame and a (scaled by 'sf') endgame score
-    ScaleFactor sf = scale_factor(eg_value(score));
-    v =  mg_value(score) * int(me->game_phase())
-       + eg_value(score) * int(PHASE_MIDGAME - me->game_phase()) * sf / SCALE_FACTOR_NORMAL;
-
-    v /= PHASE_MIDGAME;
+    v = interpolate(score);
 
     // In case of tracing add all remaining individual evaluation terms
     if (T)
@@ -967,20 +1034,98 @@ namespace {
            + Eval::Tempo;
   }
 
+
+  // evaluate_features() runs the evaluation of the terms F, telling whether the
+  // staged evaluation stopped early
+  template<int F>
+  Value evaluate_features(const Position& pos, Value alpha, Value beta, bool& cut) {
+
+    Evaluation<NO_TRACE, F> e(pos, alpha, beta);
+    Value v = e.value();
+    cut = e.cut();
+    return v;
+  }
+
+  typedef Value EvaluateFn(const Position&, Value, Value, bool&);
+
+  EvaluateFn* const Evaluators[] = {
+    evaluate_features<0>, evaluate_features<1>, evaluate_features<2>, evaluate_features<3>,
+    evaluate_features<4>, evaluate_features<5>, evaluate_features<6>, evaluate_features<7>
+  };
+
+  int CurrentFeatures = Eval::ALL_FEATURES;
+  EvaluateFn* CurrentEvaluator = Evaluators[Eval::ALL_FEATURES];
+
 } // namespace
 
 
 /// evaluate() is the evaluator for the outer world. It returns a static
 /// evaluation of the position from the point of view of the side to move.
+/// Given an (alpha, beta) window, the evaluation is staged: it is the same as
+/// without a window when inside it, otherwise it may stop early and return a
+/// bound, at or below alpha or at or above beta, that the evaluation passes.
 
 Value Eval::evaluate(const Position& pos) {
-  return Evaluation<NO_TRACE>(pos).value();
+  return evaluate(pos, -VALUE_INFINITE, VALUE_INFINITE);
+}
+
+Value Eval::evaluate(const Position& pos, Value alpha, Value beta) {
+
+  Thread* th = pos.this_thread();
+
+  // Everything the evaluation reads besides the position itself
+  Key state =  uint64_t(uint32_t(th->contempt)) << 32
+             ^ uint64_t(th->shashinValue) << 24
+             ^ uint64_t(uint16_t(th->shashinQuiescentCapablancaMaxScore)) << 8
+             ^ uint64_t(CurrentFeatures) << 1 ^ bool(lessPruningMode);
+
+  Key key = pos.key() ^ state * 0x9E3779B97F4A7C15ULL;
+  Value v;
+
+  if (th->evalCache.probe(key, v))
+      return v;
+
+  bool cut;
+  v = CurrentEvaluator(pos, alpha, beta, cut);
+
+  if (!cut)
+      th->evalCache.save(key, v);
+
+  return v;
+}
+
+
+/// set_features() selects the terms of the evaluation, and so the compiled
+/// evaluation to call, once per search before the threads start evaluating.
+
+void Eval::set_features(int features) {
+
+  assert(features >= 0 && features <= ALL_FEATURES);
+
+  CurrentFeatures = features;
+  CurrentEvaluator = Evaluators[features];
+}
+
+
+/// Eval::Cache::resize() sets the size of the table in megabytes, rounded down
+/// to a power of two number of entries. A zero size disables the cache.
+
+void Eval::Cache::resize(size_t mbSize) {
+
+  size_t count = mbSize * 1024 * 1024 / sizeof(uint64_t);
+
+  while (count & (count - 1))
+      count &= count - 1;
+
+  std::vector<uint64_t>(count).swap(table);
+  mask = count ? count - 1 : 0;
 }
 
 
 /// trace() is like evaluate(), but instead of returning a value, it returns
 /// a string (suitable for outputting to stdout) that contains the detailed
 /// descriptions and values of each evaluation term. Useful for debugging.
+/// It always traces the full evaluation, whatever the UCI_Elo.
 
 std::string Eval::trace(const Position& pos) {
 
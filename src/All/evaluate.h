@@ -22,6 +22,7 @@
 #define EVALUATE_H_INCLUDED
 
 #include <string>
+#include <vector>
 
 #include "types.h"
 
@@ -31,9 +32,63 @@ namespace Eval {
 
 constexpr Value Tempo = Value(28); // Must be visible to search
 
+/// Features are the terms of the evaluation that a reduced UCI_Elo leaves out.
+/// The evaluation is compiled for each set of them, so that at full strength
+/// it does not test them.
+enum Features {
+  PAWNS_PIECES = 1, PASSED_PAWNS = 2, INITIATIVE = 4, ALL_FEATURES = 7
+};
+
 std::string trace(const Position& pos);
 
 Value evaluate(const Position& pos);
-}
+Value evaluate(const Position& pos, Value alpha, Value beta);
+void set_features(int features);
+
+/// Eval::Cache is a per-thread hash table of the static evaluations, probed by
+/// evaluate() before running the full evaluation. A thread is the only one to
+/// access its table, so it needs no locking. An entry packs the 48 upper bits
+/// of the key with the 16 bits of the value; the key is mixed beforehand with
+/// the evaluation state of the thread (contempt, Shashin position type...),
+/// which changes the evaluation of the same position.
+
+class Cache {
+
+public:
+  void resize(size_t mbSize);
+
+  bool probe(Key key, Value& v) {
+    if (table.empty())
+        return false;
+
+#ifndef NDEBUG
+    ++probes;
+#endif
+    uint64_t e = table[key & mask];
+    if ((e ^ key) >> 16)
+        return false;
+
+#ifndef NDEBUG
+    ++hits;
+#endif
+    v = Value(int16_t(e));
+    return true;
+  }
+
+  void save(Key key, Value v) {
+    if (!table.empty())
+        table[key & mask] = (key & ~uint64_t(0xFFFF)) | uint16_t(v);
+  }
+
+#ifndef NDEBUG
+  uint64_t probes = 0, hits = 0; // Reported by dbg_print()
+#endif
+
+private:
+  std::vector<uint64_t> table;
+  Key mask = 0;
+};
+
+} // namespace Eval
 
 #endif // #ifndef EVALUATE_H_INCLUDED
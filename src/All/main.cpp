@@ -21,6 +21,7 @@
 #include <iostream>
 
 #include "bitboard.h"
+#include "perceptron.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -48,5 +49,9 @@ int main(int argc, char* argv[]) {
   UCI::loop(argc, argv);
 
   Threads.set(0);
+
+  if (Options["NN Perceptron Search"])
+      Search::SharedPerceptron.save(Search::PerceptronFile);
+
   return 0;
 }
@@ -118,10 +118,15 @@ namespace Material {
 Entry* probe(const Position& pos) {
 
   Key key = pos.material_key();
-  Entry* e = pos.this_thread()->materialTable[key];
+  Table& table = pos.this_thread()->materialTable;
+  Entry* e = table[key];
 
+  ++table.probes;
   if (e->key == key)
+  {
+      ++table.hits;
       return e;
+  }
 
   std::memset(e, 0, sizeof(Entry));
   e->key = key;
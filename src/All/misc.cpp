@@ -39,16 +39,24 @@ typedef bool(*fun1_t)(LOGICAL_PROCESSOR_RELATIONSHIP,
 typedef bool(*fun2_t)(USHORT, PGROUP_AFFINITY);
 typedef bool(*fun3_t)(HANDLE, CONST GROUP_AFFINITY*, PGROUP_AFFINITY);
 }
+#include <malloc.h> // For _aligned_malloc()
+#endif
+
+#if defined(__linux__) && !defined(__ANDROID__)
+#include <sched.h>
+#include <sys/mman.h>
 #endif
 
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <numeric>
 #include <sstream>
 #include <vector>
 
 #include "misc.h"
 #include "thread.h"
+#include "tt.h"
 
 using namespace std;
 
@@ -160,6 +168,22 @@ void dbg_print() {
   if (means[0])
       cerr << "Total " << means[0] << " Mean "
            << (double)means[1] / means[0] << endl;
+
+#ifndef NDEBUG
+  uint64_t evalProbes = 0, evalHits = 0;
+  for (Thread* th : Threads)
+      evalProbes += th->evalCache.probes, evalHits += th->evalCache.hits;
+
+  if (evalProbes)
+      cerr << "Eval cache probes " << evalProbes << " Hits " << evalHits
+           << " hit rate (%) " << 100 * evalHits / evalProbes << endl;
+#endif
+
+#ifdef USE_TT_XOR
+  if (TT.key_collisions())
+      cerr << "TT 16 bit key collisions caught "
+           << TT.key_collisions() << endl;
+#endif
 }
 
 
@@ -216,9 +240,181 @@ void prefetch2(void* addr) {
   prefetch((uint8_t*)addr + 64);
 }
 
+
+/// large_pages_alloc() returns a block of at least 'size' bytes, aligned to a
+/// huge page boundary where huge pages are available, or nullptr on failure.
+/// On Linux we first try explicit huge pages (MAP_HUGETLB, they must be reserved
+/// with vm.nr_hugepages), then fall back on an aligned block advised to the
+/// kernel as a transparent huge pages candidate. The backing we actually got is
+/// returned in 'lp' and must be passed back to large_pages_free().
+
+void* large_pages_alloc(size_t size, LargePages& lp) {
+
+  void* mem = nullptr;
+  lp = NO_LARGE_PAGES;
+
+#if defined(__linux__) && !defined(__ANDROID__)
+
+  constexpr size_t HugePageSize = 2 * 1024 * 1024; // Assume 2MB huge pages
+  size_t hugeSize = (size + HugePageSize - 1) & ~(HugePageSize - 1);
+
+#  ifdef MAP_HUGETLB
+  mem = mmap(nullptr, hugeSize, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+  if (mem != MAP_FAILED)
+  {
+      lp = EXPLICIT_LARGE_PAGES;
+      return mem;
+  }
+#  endif
+
+  if (posix_memalign(&mem, HugePageSize, hugeSize))
+      return nullptr;
+
+#  ifdef MADV_HUGEPAGE
+  if (!madvise(mem, hugeSize, MADV_HUGEPAGE))
+      lp = TRANSPARENT_LARGE_PAGES;
+#  endif
+
+#elif defined(_WIN32)
+
+  mem = _aligned_malloc(size, 64);
+
+#else
+
+  if (posix_memalign(&mem, 64, size))
+      mem = nullptr;
+
+#endif
+
+  return mem;
+}
+
+
+/// large_pages_free() releases a block obtained with large_pages_alloc()
+
+void large_pages_free(void* mem, size_t size, LargePages lp) {
+
+  if (!mem)
+      return;
+
+#if defined(__linux__) && !defined(__ANDROID__)
+
+  constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
+  if (lp == EXPLICIT_LARGE_PAGES)
+  {
+      munmap(mem, (size + HugePageSize - 1) & ~(HugePageSize - 1));
+      return;
+  }
+
+  free(mem);
+
+#elif defined(_WIN32)
+
+  (void)size, (void)lp;
+  _aligned_free(mem);
+
+#else
+
+  (void)size, (void)lp;
+  free(mem);
+
+#endif
+}
+
 namespace WinProcGroup {
 
-#ifndef _WIN32
+#if defined(__linux__) && !defined(__ANDROID__)
+
+/// cpu_list() parses a sysfs cpu list like "0-3,8,10-11" from the given file
+
+std::vector<int> cpu_list(const string& fname) {
+
+  std::vector<int> cpus;
+  ifstream file(fname);
+  string range;
+
+  while (getline(file, range, ','))
+  {
+      size_t dash = range.find('-');
+      int first = atoi(range.c_str());
+      int last  = dash == string::npos ? first : atoi(range.c_str() + dash + 1);
+
+      for (int c = first; c <= last; ++c)
+          cpus.push_back(c);
+  }
+
+  return cpus;
+}
+
+
+/// node_groups() reads the NUMA topology from sysfs and returns the node to be
+/// used by each thread index. The threads are dealt round-robin across the nodes,
+/// one per physical core, so that any number of them spreads evenly over the
+/// memory controllers, then the SMT siblings are dealt the same way.
+
+std::vector<int> node_groups() {
+
+  const string sysNode = "/sys/devices/system/node/node";
+  const string sysCpu  = "/sys/devices/system/cpu/cpu";
+
+  std::vector<int> nodes = cpu_list("/sys/devices/system/node/online");
+  std::vector<int> groups, cores(nodes.size(), 0);
+  int threads = 0;
+
+  if (nodes.size() <= 1)
+      return groups;
+
+  for (size_t i = 0; i < nodes.size(); ++i)
+      for (int c : cpu_list(sysNode + std::to_string(nodes[i]) + "/cpulist"))
+      {
+          std::vector<int> siblings = cpu_list(sysCpu + std::to_string(c)
+                                               + "/topology/thread_siblings_list");
+          threads++;
+
+          // Only the first logical processor of a core counts as a core
+          if (siblings.empty() || siblings[0] == c)
+              cores[i]++;
+      }
+
+  int totalCores = std::accumulate(cores.begin(), cores.end(), 0);
+
+  for (int round = 0; int(groups.size()) < totalCores; ++round)
+      for (size_t i = 0; i < nodes.size(); ++i)
+          if (round < cores[i])
+              groups.push_back(nodes[i]);
+
+  for (size_t t = 0; groups.size() < size_t(threads); t++)
+      groups.push_back(nodes[t % nodes.size()]);
+
+  return groups;
+}
+
+
+/// bindThisThread() sets the affinity of the current thread to all the logical
+/// processors of its NUMA node.
+
+void bindThisThread(size_t idx) {
+
+  static const std::vector<int> groups = node_groups();
+
+  // No NUMA, or more threads than logical processors: let the OS decide
+  if (idx >= groups.size())
+      return;
+
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+
+  for (int c : cpu_list("/sys/devices/system/node/node" + std::to_string(groups[idx]) + "/cpulist"))
+      if (c < CPU_SETSIZE)
+          CPU_SET(c, &mask);
+
+  sched_setaffinity(0, sizeof(cpu_set_t), &mask);
+}
+
+#elif !defined(_WIN32)
 
 void bindThisThread(size_t) {}
 
@@ -21,6 +21,7 @@
 #ifndef MISC_H_INCLUDED
 #define MISC_H_INCLUDED
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <ostream>
@@ -34,6 +35,12 @@ void prefetch(void* addr);
 void prefetch2(void* addr);
 void start_logger(const std::string& fname);
 
+/// LargePages tells how a block returned by large_pages_alloc() is backed
+enum LargePages { NO_LARGE_PAGES, TRANSPARENT_LARGE_PAGES, EXPLICIT_LARGE_PAGES };
+
+void* large_pages_alloc(size_t size, LargePages& lp);
+void large_pages_free(void* mem, size_t size, LargePages lp);
+
 void dbg_hit_on(bool b);
 void dbg_hit_on(bool c, bool b);
 void dbg_mean_of(int v);
@@ -48,12 +55,32 @@ inline TimePoint now() {
         (std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-template<class Entry, int Size>
+/// HashTable is the per-thread table of the pawn and material entries. Its size
+/// is set at runtime by resize(), in kilobytes rounded down to a power of two
+/// number of entries. The probe functions count the lookups and the hits.
+
+template<class Entry>
 struct HashTable {
-  Entry* operator[](Key key) { return &table[(uint32_t)key & (Size - 1)]; }
+  Entry* operator[](Key key) { return &table[(uint32_t)key & mask]; }
+
+  void resize(size_t kbSize) {
+    size_t count = std::max(kbSize * 1024 / sizeof(Entry), size_t(1));
+
+    while (count & (count - 1))
+        count &= count - 1;
+
+    std::vector<Entry>(count).swap(table); // Allocate on the heap
+    mask = count - 1;
+    probes = hits = 0;
+  }
+
+  size_t size() const { return table.size(); }
+
+  uint64_t probes = 0, hits = 0;
 
 private:
-  std::vector<Entry> table = std::vector<Entry>(Size); // Allocate on the heap
+  std::vector<Entry> table = std::vector<Entry>(1);
+  size_t mask = 0;
 };
 
 
@@ -105,7 +132,9 @@ public:
 /// logical processor group. This usually means to be limited to use max 64
 /// cores. To overcome this, some special platform specific API should be
 /// called to set group affinity for each thread. Original code from Texel by
-/// Peter Österlund.
+/// Peter Österlund. On Linux the same thread index to NUMA node mapping is
+/// built from sysfs, so that memory first touched by a bound thread is local
+/// to the node where the search thread with the same index will run.
 
 namespace WinProcGroup {
   void bindThisThread(size_t idx);
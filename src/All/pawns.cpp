@@ -159,10 +159,15 @@ namespace Pawns {
 Entry* probe(const Position& pos) {
 
   Key key = pos.pawn_key();
-  Entry* e = pos.this_thread()->pawnsTable[key];
+  Table& table = pos.this_thread()->pawnsTable;
+  Entry* e = table[key];
 
+  ++table.probes;
   if (e->key == key)
+  {
+      ++table.hits;
       return e;
+  }
 
   e->key = key;
   e->scores[WHITE] = evaluate<WHITE>(pos, e);
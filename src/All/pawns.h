@@ -74,7 +74,7 @@ struct Entry {
   int passedCount;
 };
 
-typedef HashTable<Entry, 16384> Table;
+typedef HashTable<Entry> Table;
 
 Entry* probe(const Position& pos);
 
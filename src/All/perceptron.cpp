@@ -0,0 +1,329 @@
+/*
+  ShashChess, a UCI chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  ShashChess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  ShashChess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <chrono>
+#include <cstring>   // For std::memset
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#if defined(USE_AVX2)
+#include <immintrin.h>
+#elif defined(USE_SSE)
+#include <xmmintrin.h>
+#endif
+
+#include "misc.h"
+#include "perceptron.h"
+
+using namespace Search;
+
+Perceptron Search::SharedPerceptron;
+
+namespace {
+
+  /// Perceptron files start with this header, followed by the weights
+  struct PerceptronFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t rows;
+    uint32_t lanes;
+    uint32_t padding;
+  };
+
+  constexpr char PerceptronFileMagic[8] = { 'S', 'H', 'A', 'S', 'H', 'P', 'R', 'C' };
+  constexpr uint32_t PerceptronFileVersion = 1;
+
+  // expand() returns in x the input of the bias, always 1, then the features,
+  // then zeroes up to Perceptron::Rows.
+  void expand(const float input[Perceptron::Inputs], float x[Perceptron::Rows]) {
+
+    x[0] = 1.0f;
+    std::memcpy(x + 1, input, Perceptron::Inputs * sizeof(float));
+    std::memset(x + 1 + Perceptron::Inputs, 0, (Perceptron::Rows - 1 - Perceptron::Inputs) * sizeof(float));
+  }
+
+  // best_class() returns the output with the highest sum
+  int best_class(const float sums[Perceptron::Lanes]) {
+
+    float bestFit   = -100000000.0;
+    int   bestClass = -1;
+
+    for (int d1 = 0; d1 < Perceptron::Outputs; d1++)
+        if (bestFit < sums[d1])
+        {
+            bestFit = sums[d1];
+            bestClass = d1;
+        }
+
+    return bestClass;
+  }
+
+  // time_per_call() returns the average time, in nanoseconds, of a call of f
+  // on each of the given feature vectors.
+  template<typename F>
+  double time_per_call(const std::vector<float>& features, F f) {
+
+    constexpr int Rounds = 1000;
+    auto start = std::chrono::steady_clock::now();
+
+    for (int r = 0; r < Rounds; ++r)
+        for (size_t i = 0; i < features.size(); i += Perceptron::Inputs)
+            f(&features[i]);
+
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() * Perceptron::Inputs / (double(Rounds) * features.size());
+  }
+
+} // namespace
+
+
+//perceptron_scratch begin
+/// Perceptron::init() sets the weights to their initial values
+
+void Perceptron::init() {
+
+  std::memset(weights, 0, sizeof(weights));
+
+  for (int d1 = 0; d1 <= Inputs; d1++)
+    for (int d2 = 0; d2 < Outputs; d2++)
+    {
+      weights[d1][d2] = float(d1*d2) - Inputs*Outputs / 4.0;
+    }
+}
+
+
+/// Perceptron::infer_scalar() returns the class of the given features. It is
+/// the portable version of infer().
+
+int Perceptron::infer_scalar(const float input[Inputs]) const {
+
+  float x[Rows], sums[Lanes] = {};
+  expand(input, x);
+
+  for (int d2 = 0; d2 < Rows; d2++)
+      for (int d1 = 0; d1 < Outputs; d1++)
+          sums[d1] += weights[d2][d1] * x[d2];
+
+  return best_class(sums);
+}
+
+
+/// Perceptron::train_scalar() moves every weight towards zero, proportionally
+/// to its input, after a wrong prediction. It is the portable version of train().
+
+void Perceptron::train_scalar(const float input[Inputs], float rate) {
+
+  float x[Rows];
+  expand(input, x);
+
+  for (int d2 = 0; d2 < Rows; d2++)
+      for (int d1 = 0; d1 < Outputs; d1++)
+          weights[d2][d1] -= ((weights[d2][d1] > 0) - (weights[d2][d1] < 0)) * x[d2] * rate;
+}
+
+
+/// Perceptron::infer() returns the class of the given features
+
+int Perceptron::infer(const float input[Inputs]) const {
+
+#if defined(USE_AVX2)
+
+  float x[Rows];
+  expand(input, x);
+
+  // Two inputs per iteration, the first one in the low half
+  __m256 acc = _mm256_setzero_ps();
+  for (int d2 = 0; d2 < Rows; d2 += 2)
+  {
+      __m256 xv = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(x[d2])),
+                                       _mm_set1_ps(x[d2 + 1]), 1);
+      acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_loadu_ps(weights[d2]), xv));
+  }
+
+  alignas(16) float sums[Lanes];
+  _mm_store_ps(sums, _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1)));
+  return best_class(sums);
+
+#elif defined(USE_SSE)
+
+  float x[Rows];
+  expand(input, x);
+
+  __m128 acc = _mm_setzero_ps();
+  for (int d2 = 0; d2 < Rows; d2++)
+      acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(weights[d2]), _mm_set1_ps(x[d2])));
+
+  alignas(16) float sums[Lanes];
+  _mm_store_ps(sums, acc);
+  return best_class(sums);
+
+#else
+
+  return infer_scalar(input);
+
+#endif
+}
+
+
+/// Perceptron::train() updates the weights after a wrong prediction. The sign
+/// of each weight is computed with compare masks instead of branches.
+
+void Perceptron::train(const float input[Inputs], float rate) {
+
+#if defined(USE_AVX2)
+
+  float x[Rows];
+  expand(input, x);
+
+  const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+
+  for (int d2 = 0; d2 < Rows; d2 += 2)
+  {
+      __m256 w = _mm256_loadu_ps(weights[d2]);
+      __m256 sign = _mm256_sub_ps(_mm256_and_ps(_mm256_cmp_ps(w, zero, _CMP_GT_OQ), one),
+                                  _mm256_and_ps(_mm256_cmp_ps(w, zero, _CMP_LT_OQ), one));
+      __m256 step = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_set1_ps(x[d2] * rate)),
+                                         _mm_set1_ps(x[d2 + 1] * rate), 1);
+      _mm256_storeu_ps(weights[d2], _mm256_sub_ps(w, _mm256_mul_ps(sign, step)));
+  }
+
+#elif defined(USE_SSE)
+
+  float x[Rows];
+  expand(input, x);
+
+  const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+
+  for (int d2 = 0; d2 < Rows; d2++)
+  {
+      __m128 w = _mm_loadu_ps(weights[d2]);
+      __m128 sign = _mm_sub_ps(_mm_and_ps(_mm_cmpgt_ps(w, zero), one),
+                               _mm_and_ps(_mm_cmplt_ps(w, zero), one));
+      _mm_storeu_ps(weights[d2], _mm_sub_ps(w, _mm_mul_ps(sign, _mm_set1_ps(x[d2] * rate))));
+  }
+
+#else
+
+  train_scalar(input, rate);
+
+#endif
+}
+//perceptron_scratch end
+
+
+/// Perceptron::load() reads the weights written by save(). It returns false,
+/// leaving the weights unchanged, if the file is missing or was written for a
+/// different number of inputs or outputs.
+
+bool Perceptron::load(const std::string& fname) {
+
+  PerceptronFileHeader h;
+  float w[Rows][Lanes];
+  std::ifstream file(fname, std::ios::in | std::ios::binary);
+
+  if (   !file.read((char*)&h, sizeof(h))
+      ||  std::memcmp(h.magic, PerceptronFileMagic, sizeof(h.magic))
+      ||  h.version != PerceptronFileVersion
+      ||  h.rows != Rows
+      ||  h.lanes != Lanes
+      || !file.read((char*)w, sizeof(w)))
+      return false;
+
+  std::memcpy(weights, w, sizeof(weights));
+  return true;
+}
+
+
+/// Perceptron::save() writes the weights to the given file
+
+bool Perceptron::save(const std::string& fname) const {
+
+  PerceptronFileHeader h = {};
+  std::memcpy(h.magic, PerceptronFileMagic, sizeof(h.magic));
+  h.version = PerceptronFileVersion;
+  h.rows = Rows;
+  h.lanes = Lanes;
+
+  std::ofstream file(fname, std::ios::out | std::ios::binary | std::ios::trunc);
+  file.write((const char*)&h, sizeof(h));
+  file.write((const char*)weights, sizeof(weights));
+  file.close();
+
+  if (!file)
+      sync_cout << "info string Could not save perceptron to " << fname << sync_endl;
+
+  return bool(file);
+}
+
+
+/// Perceptron::bench() is a micro-benchmark of infer() and train() against their
+/// scalar versions, reporting the nanoseconds per call.
+
+std::string Perceptron::bench() {
+
+  constexpr int Samples = 4096;
+
+  PRNG rng(1070372);
+  std::vector<float> features(Samples * Inputs);
+
+  for (float& f : features)
+      f = float(int(rng.rand<uint32_t>() % 200001) - 100000) / 8;
+
+  Perceptron p, q;
+  p.init();
+  int mismatches = 0;
+
+  for (int i = 0; i < Samples; ++i)
+      mismatches += p.infer(&features[i * Inputs]) != p.infer_scalar(&features[i * Inputs]);
+
+  volatile int sink = 0; // Keeps the compiler from dropping the calls
+  double ns[4];
+
+  ns[0] = time_per_call(features, [&](const float* in) { sink += p.infer_scalar(in); });
+  ns[1] = time_per_call(features, [&](const float* in) { sink += p.infer(in); });
+  q = p;
+  ns[2] = time_per_call(features, [&](const float* in) { q.train_scalar(in, 1e-2); });
+  sink += int(q.weights[0][0]);
+  q = p;
+  ns[3] = time_per_call(features, [&](const float* in) { q.train(in, 1e-2); });
+  sink += int(q.weights[0][0]);
+
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(2)
+     << "Perceptron with " << Inputs << " inputs, "
+#if defined(USE_AVX2)
+     << "AVX2\n"
+#elif defined(USE_SSE)
+     << "SSE\n"
+#else
+     << "no SIMD\n"
+#endif
+     << "Infer scalar (ns/call) : " << ns[0] << "\n"
+     << "Infer        (ns/call) : " << ns[1] << "\n"
+     << "Train scalar (ns/call) : " << ns[2] << "\n"
+     << "Train        (ns/call) : " << ns[3] << "\n"
+     << "Mismatches             : " << mismatches << " of " << Samples;
+
+  return ss.str();
+}
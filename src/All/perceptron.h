@@ -0,0 +1,69 @@
+/*
+  ShashChess, a UCI chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  ShashChess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  ShashChess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PERCEPTRON_H_INCLUDED
+#define PERCEPTRON_H_INCLUDED
+
+#include <string>
+
+namespace Search {
+
+/// Perceptron is the linear classifier used by search() to adjust the late move
+/// reductions when "NN Perceptron Search" is on. Each thread trains its own copy
+/// of the weights, so that threads do not fight over their cache lines, and the
+/// copies are averaged at the end of each search.
+///
+/// The bias is stored as the weights of an input always equal to 1. The weights
+/// of an input are padded to 4 floats, and the inputs to an even count, so that
+/// infer() and train() process a whole input per SSE instruction, or two per
+/// AVX2 instruction. More inputs so cost one instruction each, or half of one.
+
+struct Perceptron {
+
+  static constexpr int Inputs  = 4;
+  static constexpr int Outputs = 3;
+  static constexpr int Lanes   = 4;                  // Outputs, padded
+  static constexpr int Rows    = (Inputs + 2) & ~1;  // Bias and inputs, padded
+
+  static_assert(Outputs <= Lanes, "Outputs must fit in a SIMD register");
+
+  void init();
+  int infer(const float input[Inputs]) const;
+  void train(const float input[Inputs], float rate);
+  int infer_scalar(const float input[Inputs]) const;
+  void train_scalar(const float input[Inputs], float rate);
+
+  bool load(const std::string& fname);
+  bool save(const std::string& fname) const;
+
+  static std::string bench();
+
+  float weights[Rows][Lanes];
+};
+
+/// The weights each thread starts a search with, saved between sessions in
+/// PerceptronFile so that the learning is not lost at exit.
+extern Perceptron SharedPerceptron;
+const std::string PerceptronFile = "perceptron.bin";
+
+} // namespace Search
+
+#endif // #ifndef PERCEPTRON_H_INCLUDED
@@ -350,12 +350,25 @@ void Position::set_castling_right(Color c, Square rfrom) {
 }
 
 
-/// Position::set_check_info() sets king attacks to detect if a move gives check
+/// Position::set_check_info() sets king attacks to detect if a move gives check.
+/// The blockers and pinners of a king depend only on the squares on its lines,
+/// so they are copied from the previous state if no square changed by the last
+/// move is the king square or on one of its lines.
 
-void Position::set_check_info(StateInfo* si) const {
+void Position::set_check_info(StateInfo* si, Bitboard changed) const {
 
-  si->blockersForKing[WHITE] = slider_blockers(pieces(BLACK), square<KING>(WHITE), si->pinners[BLACK]);
-  si->blockersForKing[BLACK] = slider_blockers(pieces(WHITE), square<KING>(BLACK), si->pinners[WHITE]);
+  for (Color c : { WHITE, BLACK })
+  {
+      Square ksq = square<KING>(c);
+
+      if (changed & (PseudoAttacks[QUEEN][ksq] | ksq))
+          si->blockersForKing[c] = slider_blockers(pieces(~c), ksq, si->pinners[~c]);
+      else
+      {
+          si->blockersForKing[c] = si->previous->blockersForKing[c];
+          si->pinners[~c] = si->previous->pinners[~c];
+      }
+  }
 
   Square ksq = square<KING>(~sideToMove);
 
@@ -368,6 +381,47 @@ void Position::set_check_info(StateInfo* si) const {
 }
 
 
+#ifdef USE_INCREMENTAL_ATTACKS
+
+/// Position::set_attacks() updates the squares attacked by each color and piece
+/// type after a move that changed the given squares. The 'touched' bit 8 * c + pt
+/// is set when a piece of color c and type pt moved, was captured or promoted
+/// to, and its attacks are computed again. A slider is also affected if it was
+/// attacking a changed square; any other square is off its lines or behind a
+/// blocker, so its attacks are kept from the previous state.
+
+void Position::set_attacks(StateInfo* si, Bitboard changed, int touched) const {
+
+  for (Color c : { WHITE, BLACK })
+  {
+      si->attacks[c][ALL_PIECES] = 0;
+
+      for (PieceType pt = PAWN; pt <= KING; ++pt)
+      {
+          Bitboard& b = si->attacks[c][pt];
+
+          if (   !(touched & (1 << (8 * c + pt)))
+              && !(pt >= BISHOP && pt <= QUEEN && (changed & si->previous->attacks[c][pt])))
+              b = si->previous->attacks[c][pt];
+
+          else if (pt == PAWN)
+              b = c == WHITE ? pawn_attacks_bb<WHITE>(pieces(c, PAWN))
+                             : pawn_attacks_bb<BLACK>(pieces(c, PAWN));
+          else
+          {
+              b = 0;
+              for (Bitboard p = pieces(c, pt); p; )
+                  b |= attacks_from(pt, pop_lsb(&p));
+          }
+
+          si->attacks[c][ALL_PIECES] |= b;
+      }
+  }
+}
+
+#endif
+
+
 /// Position::set_state() computes the hash keys of the position, and other
 /// data that once computed is updated incrementally as moves are made.
 /// The function is only used when a new position is set up, and to verify
@@ -382,6 +436,10 @@ void Position::set_state(StateInfo* si) const {
 
   set_check_info(si);
 
+#ifdef USE_INCREMENTAL_ATTACKS
+  set_attacks(si, AllSquares, -1);
+#endif
+
   for (Bitboard b = pieces(); b; )
   {
       Square s = pop_lsb(&b);
@@ -573,7 +631,11 @@ bool Position::legal(Move m) const {
       Direction step = to > from ? WEST : EAST;
 
       for (Square s = to; s != from; s += step)
+#ifdef USE_INCREMENTAL_ATTACKS
+          if (attacked_by(~us) & s)
+#else
           if (attackers_to(s) & pieces(~us))
+#endif
               return false;
 
       // In case of Chess960, verify that when moving the castling rook we do
@@ -586,7 +648,11 @@ bool Position::legal(Move m) const {
   // If the moving piece is a king, check whether the destination square is
   // attacked by the opponent.
   if (type_of(piece_on(from)) == KING)
+#ifdef USE_INCREMENTAL_ATTACKS
+      return !(attacked_by(~us) & to);
+#else
       return !(attackers_to(to) & pieces(~us));
+#endif
 
   // A non-king move is legal if and only if it is not pinned or it
   // is moving along the ray towards or away from the king.
@@ -754,6 +820,10 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   Square to = to_sq(m);
   Piece pc = piece_on(from);
   Piece captured = type_of(m) == ENPASSANT ? make_piece(them, PAWN) : piece_on(to);
+  Bitboard changed = square_bb(from) | to;
+#ifdef USE_INCREMENTAL_ATTACKS
+  int touched = 1 << (8 * us + type_of(pc));
+#endif
 
   assert(color_of(pc) == us);
   assert(captured == NO_PIECE || color_of(captured) == (type_of(m) != CASTLING ? them : us));
@@ -768,6 +838,10 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
       do_castling<true>(us, from, to, rfrom, rto);
 
       k ^= Zobrist::psq[captured][rfrom] ^ Zobrist::psq[captured][rto];
+      changed |= square_bb(rfrom) | rto | to;
+#ifdef USE_INCREMENTAL_ATTACKS
+      touched |= 1 << (8 * us + ROOK);
+#endif
       captured = NO_PIECE;
   }
 
@@ -799,6 +873,10 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
       // Update board and piece lists
       remove_piece(captured, capsq);
+      changed |= capsq;
+#ifdef USE_INCREMENTAL_ATTACKS
+      touched |= 1 << (8 * them + type_of(captured));
+#endif
 
       // Update material hash key and prefetch access to materialTable
       k ^= Zobrist::psq[captured][capsq];
@@ -851,6 +929,9 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
 
           remove_piece(pc, to);
           put_piece(promotion, to);
+#ifdef USE_INCREMENTAL_ATTACKS
+          touched |= 1 << (8 * us + promotion_type(m));
+#endif
 
           // Update hash keys
           k ^= Zobrist::psq[pc][to] ^ Zobrist::psq[promotion][to];
@@ -882,7 +963,11 @@ void Position::do_move(Move m, StateInfo& newSt, bool givesCheck) {
   sideToMove = ~sideToMove;
 
   // Update king attacks used for fast check detection
-  set_check_info(st);
+  set_check_info(st, changed);
+
+#ifdef USE_INCREMENTAL_ATTACKS
+  set_attacks(st, changed, touched);
+#endif
 
   assert(pos_is_ok());
 }
@@ -997,7 +1082,7 @@ void Position::do_null_move(StateInfo& newSt) {
 
   sideToMove = ~sideToMove;
 
-  set_check_info(st);
+  set_check_info(st, 0);
 
   assert(pos_is_ok());
 }
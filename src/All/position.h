@@ -58,6 +58,9 @@ struct StateInfo {
   Bitboard   blockersForKing[COLOR_NB];
   Bitboard   pinners[COLOR_NB];
   Bitboard   checkSquares[PIECE_TYPE_NB];
+#ifdef USE_INCREMENTAL_ATTACKS
+  Bitboard   attacks[COLOR_NB][PIECE_TYPE_NB];
+#endif
 };
 
 /// A list to keep track of the position states along the setup moves (from the
@@ -119,6 +122,9 @@ public:
   template<PieceType> Bitboard attacks_from(Square s) const;
   template<PieceType> Bitboard attacks_from(Square s, Color c) const;
   Bitboard slider_blockers(Bitboard sliders, Square s, Bitboard& pinners) const;
+#ifdef USE_INCREMENTAL_ATTACKS
+  Bitboard attacked_by(Color c, PieceType pt = ALL_PIECES) const;
+#endif
 
   // Properties of moves
   bool legal(Move m) const;
@@ -171,7 +177,10 @@ private:
   // Initialization helpers (used while setting up a position)
   void set_castling_right(Color c, Square rfrom);
   void set_state(StateInfo* si) const;
-  void set_check_info(StateInfo* si) const;
+  void set_check_info(StateInfo* si, Bitboard changed = AllSquares) const;
+#ifdef USE_INCREMENTAL_ATTACKS
+  void set_attacks(StateInfo* si, Bitboard changed, int touched) const;
+#endif
 
   // Other helpers
   void put_piece(Piece pc, Square s);
@@ -314,6 +323,12 @@ inline Bitboard Position::check_squares(PieceType pt) const {
   return st->checkSquares[pt];
 }
 
+#ifdef USE_INCREMENTAL_ATTACKS
+inline Bitboard Position::attacked_by(Color c, PieceType pt) const {
+  return st->attacks[c][pt];
+}
+#endif
+
 inline bool Position::pawn_passed(Color c, Square s) const {
   return !(pieces(~c, PAWN) & passed_pawn_span(c, s));
 }
@@ -18,6 +18,7 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <array>
 #include <cassert>
 #include <cmath>
 #include <cstring>   // For std::memset
@@ -35,13 +36,13 @@
 #include "timeman.h"
 #include "tt.h"
 #include "uci.h"
+#include "uct.h"
 #include "syzygy/tbprobe.h"
 
-bool pawnsPiecesToEvaluate, passedPawnsToEvaluate,initiativeToEvaluate; //from Shashin Handicap mode
 int lessPruningMode;//from Sugar
 //kellykynyama mcts begin
 bool useExp = true;
-bool expHits;
+std::atomic<bool> expHits;
 int Movesplayed = 0;
 bool startpoint = false;
 int openingswritten = 0;
@@ -57,6 +58,11 @@ namespace Search {
   //end from Shashin
   //mcts begin
   bool perceptronSearch;
+  bool parallelPlayouts;
+  bool mctsSearch;
+  bool multiPVSplit;
+  bool smpSkipBlocks;
+  bool smpBusyMarks;
   bool persistedSelfLearning;
   //mcts end
 }
@@ -132,6 +138,172 @@ namespace {
     int level;
     Move best = MOVE_NONE;
   };
+  // playout_move() picks the root move a thread plays out at the end of an
+  // iteration. The moves are ranked by the mean score of their visits, plus
+  // an exploration bonus for the less visited ones, and each thread takes a
+  // different one of the best, so that the playouts of the helper threads
+  // spread over the root moves instead of all following the best one.
+  Move playout_move(const RootMoves& rootMoves, size_t threadIdx) {
+
+    int64_t total = 0;
+
+    for (const RootMove& rm : rootMoves)
+        total += rm.visits;
+
+    std::vector<std::pair<double, size_t>> ranked;
+
+    for (size_t i = 0; i < rootMoves.size(); ++i)
+    {
+        const RootMove& rm = rootMoves[i];
+        double mean = rm.visits ? double(rm.zScore) / rm.visits : double(rm.score);
+        double bonus = int(PawnValueMg) * std::sqrt(std::log(1.0 + total) / (1.0 + rm.visits));
+        ranked.emplace_back(mean + bonus, i);
+    }
+
+    std::stable_sort(ranked.begin(), ranked.end(),
+                     [](const std::pair<double, size_t>& a, const std::pair<double, size_t>& b) {
+                         return a.first > b.first; });
+
+    size_t width = std::min(rootMoves.size(), Threads.size());
+    return rootMoves[ranked[threadIdx % width].second].pv[0];
+  }
+
+  // Sizes and phases of the skip-blocks, used for distributing search depths
+  // across the helper threads when "SMP Skip Blocks" is on
+  constexpr int SkipSize[]  = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+  constexpr int SkipPhase[] = { 0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7 };
+
+  // Breadcrumbs mark the nodes near the root being searched by a thread, in the
+  // manner of ABDADA, when "SMP Busy Marks" is on. They are kept in a small
+  // table of their own, indexed by the 10 lowest bits of the position key, as a
+  // TT entry has no spare bit.
+  struct Breadcrumb {
+    std::atomic<Thread*> thread;
+    std::atomic<Key> key;
+  };
+  std::array<Breadcrumb, 1024> breadcrumbs;
+
+  // ThreadHolding marks a free node in its constructor, called on entering the
+  // moves loop, and frees it in its destructor. A node already marked by another
+  // thread is reported by marked(), so that its moves are reduced more.
+  struct ThreadHolding {
+    explicit ThreadHolding(Thread* thisThread, Key posKey, int ply) {
+      location = smpBusyMarks && ply < 8 ? &breadcrumbs[posKey & (breadcrumbs.size() - 1)] : nullptr;
+      otherThread = owning = false;
+
+      if (location)
+      {
+          // See if another thread already marked this location, if not mark it
+          Thread* tmp = location->thread.load(std::memory_order_relaxed);
+          if (tmp == nullptr)
+          {
+              location->thread.store(thisThread, std::memory_order_relaxed);
+              location->key.store(posKey, std::memory_order_relaxed);
+              owning = true;
+          }
+          else if (   tmp != thisThread
+                   && location->key.load(std::memory_order_relaxed) == posKey)
+              otherThread = true;
+      }
+    }
+
+   ~ThreadHolding() {
+      if (owning) // Free the marked location
+          location->thread.store(nullptr, std::memory_order_relaxed);
+    }
+
+    bool marked() const { return otherThread; }
+
+  private:
+    Breadcrumb* location;
+    bool otherThread, owning;
+  };
+
+  // RootSplit hands out the PV lines of each iteration to the threads when
+  // "MultiPV Split" is on, so that every line is searched by a single thread
+  // instead of by all of them. A thread takes the next line not taken yet at
+  // its depth, and publishes its result, keeping for each move the deepest one.
+  // At the start of each iteration a thread brings the published moves to the
+  // front of its root moves, those searched at this depth first, so that the
+  // threads agree on the moves excluded from each line. Two threads may still
+  // find the same move for two lines, so once all the lines of a depth are
+  // published the main thread searches itself the lines still missing.
+  struct RootSplit {
+
+    void clear();
+    size_t take(Depth d) { return next[d / ONE_PLY].fetch_add(1, std::memory_order_relaxed); }
+    bool published(Depth d, size_t multiPV) const { return count[d / ONE_PLY] >= multiPV; }
+    void publish(const RootMove& rm, Depth d);
+    size_t merge(RootMoves& rootMoves, Depth d);
+
+    Mutex mutex;
+    std::atomic<size_t> next[MAX_PLY], count[MAX_PLY];
+    std::vector<std::pair<Depth, RootMove>> moves;
+  };
+
+  RootSplit RootLines;
+
+  void RootSplit::clear() {
+
+    for (size_t i = 0; i < MAX_PLY; ++i)
+        next[i] = count[i] = 0;
+
+    moves.clear();
+  }
+
+  void RootSplit::publish(const RootMove& rm, Depth d) {
+
+    std::lock_guard<Mutex> lk(mutex);
+
+    auto m = std::find_if(moves.begin(), moves.end(),
+                          [&](const std::pair<Depth, RootMove>& x) { return x.second.pv[0] == rm.pv[0]; });
+
+    if (m == moves.end())
+        moves.emplace_back(d, rm);
+
+    else if (d >= m->first)
+        *m = std::make_pair(d, rm);
+
+    count[d / ONE_PLY]++; // A line is taken once per depth
+  }
+
+  // RootSplit::merge() brings the published moves to the front of the root
+  // moves, and returns how many of them, in front, were searched at depth d.
+  size_t RootSplit::merge(RootMoves& rootMoves, Depth d) {
+
+    std::lock_guard<Mutex> lk(mutex);
+    size_t placed = 0;
+
+    for (const auto& m : moves)
+    {
+        auto rm = std::find(rootMoves.begin() + placed, rootMoves.end(), m.second.pv[0]);
+
+        if (rm == rootMoves.end())
+            continue;
+
+        std::rotate(rootMoves.begin() + placed, rm, rm + 1);
+        rootMoves[placed].score = m.second.score;
+        rootMoves[placed].selDepth = m.second.selDepth;
+        rootMoves[placed].pv = m.second.pv;
+        rootMoves[placed].splitDepth = m.first;
+        placed++;
+    }
+
+    // Sort the moves by tablebase rank, as the search itself does, then those
+    // searched at depth d first, then by score.
+    std::stable_sort(rootMoves.begin(), rootMoves.begin() + placed,
+                     [d](const RootMove& a, const RootMove& b) {
+                         return  a.tbRank != b.tbRank ? a.tbRank > b.tbRank
+                               : (a.splitDepth >= d) != (b.splitDepth >= d) ? a.splitDepth >= d
+                               : a < b; });
+
+    size_t fresh = 0;
+    while (fresh < placed && rootMoves[fresh].splitDepth >= d)
+        fresh++;
+
+    return fresh;
+  }
+
   bool limitStrength ;//from Shashin
   int variety;//from Sugar
   template <NodeType NT>
@@ -172,41 +344,6 @@ namespace {
     }
     return nodes;
   }
-
-  //perceptron_scratch begin
-  constexpr int percInput     = 4;
-  constexpr int percOutput    = 3;
-  float perceptronWeights[percInput + 1][percOutput];
-
-  int infer(float input[percInput]){
-      float continuousClasses[percOutput];
-      float bestFit     = -100000000.0;
-      int   bestClass   = -1;
-      std::memset(continuousClasses, 0.0, sizeof continuousClasses);
-
-      for (int d1 = 0; d1 < percOutput; d1++){
-          continuousClasses[d1] += perceptronWeights[0][d1]; // bias
-          for (int d2 = 0; d2 < percInput; d2++){
-              continuousClasses[d1] += perceptronWeights[1 + d2][d1] * input[d2];
-          }
-          if (bestFit < continuousClasses[d1]){
-             bestFit = continuousClasses[d1];
-             bestClass = d1;
-          }
-      }
-      return bestClass;
-  }
-
-  void train(float input[percInput], float rate){
-      for (int d1 = 0; d1 < percOutput; d1++){
-          perceptronWeights[0][d1] -= ((perceptronWeights[0][d1]  > 0) - (perceptronWeights[0][d1]  < 0)) * rate;
-          for (int d2 = 0; d2 < percInput; d2++){
-              perceptronWeights[1 + d2][d1] -=  ((perceptronWeights[1 + d2][d1] > 0) - (perceptronWeights[1 + d2][d1] < 0)) * input[d2] * rate;
-          }
-      }
-  }
-
-  //perceptron_scratch end
 } // namespace
 
 
@@ -217,11 +354,8 @@ void Search::init() {
   for (int i = 1; i < 64; ++i)
       Reductions[i] = int(1024 * std::log(i) / std::sqrt(1.95));
   //perceptron_scratch begin
-  for (int d1 = 0; d1 <= percInput; d1++)
-    for (int d2 = 0; d2 < percOutput; d2++)
-    {
-      perceptronWeights[d1][d2] = float(d1*d2) - percInput*percOutput / 4.0;
-    }
+  if (!SharedPerceptron.load(PerceptronFile)) // Start warm if trained before
+      SharedPerceptron.init();
   //perceptron_scratch end
   //from Corchess
   for (int imp = 0; imp <= 1; ++imp)
@@ -247,9 +381,13 @@ void Search::clear() {
   Threads.main()->wait_for_search_finished();
 
   Time.availableNodes = 0;
-  TT.clear();
+  if (!Options["Never Clear Hash"])
+      TT.clear();
   Threads.clear();
   Tablebases::init(Options["SyzygyPath"]); // Free mapped files
+
+  if (Options["NN Perceptron Search"])
+      SharedPerceptron.save(PerceptronFile);
 }
 
 
@@ -272,12 +410,18 @@ void MainThread::search() {
   TT.new_search();
   //mcts begin
   perceptronSearch=Options["NN Perceptron Search"];
+  parallelPlayouts=Options["NN Parallel Playouts"];
+  mctsSearch=Options["NN MCTS Search"];
+  multiPVSplit=Options["MultiPV Split"];
+  smpSkipBlocks=Options["SMP Skip Blocks"];
+  smpBusyMarks=Options["SMP Busy Marks"];
   persistedSelfLearning=Options["NN Persisted Self-Learning"];
   //mcts end
   //KellyKinyama mcts begin
   int piecesCnt=0;
   if(persistedSelfLearning){
 	  expHits = false;
+	  EXPresize(); // Loads only what changed since the previous search
 	  piecesCnt = rootPos.count<KNIGHT>(WHITE) + rootPos.count<BISHOP>(WHITE) + rootPos.count<ROOK>(WHITE) + rootPos.count<QUEEN>(WHITE) + rootPos.count<KING>(WHITE)
 		  + rootPos.count<KNIGHT>(BLACK) + rootPos.count<BISHOP>(BLACK) + rootPos.count<ROOK>(BLACK) + rootPos.count<QUEEN>(BLACK) + rootPos.count<KING>(BLACK);
 	
@@ -301,13 +445,15 @@ void MainThread::search() {
   tal=Options["Tal"];
   capablanca=Options["Capablanca"];
   petrosian=Options["Petrosian"];
-  pawnsPiecesToEvaluate = uciElo >= 2000;
-  passedPawnsToEvaluate = uciElo>=2200;
-  initiativeToEvaluate= uciElo>=2400;
+  Eval::set_features(  (uciElo >= 2000 ? Eval::PAWNS_PIECES : 0)
+                     | (uciElo >= 2200 ? Eval::PASSED_PAWNS : 0)
+                     | (uciElo >= 2400 ? Eval::INITIATIVE   : 0));
   skillLevel= ((int)((uciElo-1500)/65));
   //end from Shashin
 
-  if (rootMoves.empty())
+  bool searched = !rootMoves.empty();
+
+  if (!searched)
   {
       rootMoves.emplace_back(MOVE_NONE);
       sync_cout << "info depth 0 score "
@@ -316,6 +462,14 @@ void MainThread::search() {
   }
   else
   {
+      MCTS.publish(); // Experience is read-only from here until the search ends
+
+      if (mctsSearch)
+          UCT::SearchTree.clear();
+
+      if (multiPVSplit)
+          RootLines.clear();
+
       for (Thread* th : Threads)
           if (th != this)
               th->start_searching();
@@ -329,8 +483,7 @@ void MainThread::search() {
   // GUI sends a "stop" or "ponderhit" command. We therefore simply wait here
   // until the GUI sends one of those commands.
 
-  while (!Threads.stop && (ponder || Limits.infinite))
-  {} // Busy wait for a stop or a ponder reset
+  wait_for_stop();
 
   // Stop the threads if not already stopped (also raise the stop if
   // "ponderhit" just reset Threads.ponder).
@@ -341,6 +494,20 @@ void MainThread::search() {
       if (th != this)
           th->wait_for_search_finished();
 
+  // The threads are idle, so their perceptrons can be averaged without locking.
+  // Only after a search: each started thread copies SharedPerceptron first thing
+  // in Thread::search(), otherwise they all hold the weights of an older search.
+  if (perceptronSearch && searched)
+      for (int d1 = 0; d1 <= Perceptron::Inputs; d1++)
+          for (int d2 = 0; d2 < Perceptron::Outputs; d2++)
+          {
+              float sum = 0;
+              for (Thread* th : Threads)
+                  sum += th->perceptron.weights[d1][d2];
+
+              SharedPerceptron.weights[d1][d2] = sum / Threads.size();
+          }
+
   // When playing in 'nodes as time' mode, subtract the searched nodes from
   // the available ones before exiting.
   if (Limits.npmsec)
@@ -352,6 +519,7 @@ void MainThread::search() {
   if (    Options["MultiPV"] == 1
       && !Limits.depth
       && !limitStrength //From Shashin
+      && !mctsSearch // All the threads share the same tree
       &&  rootMoves[0].pv[0] != MOVE_NONE)
   {
       std::map<Move, int64_t> votes;
@@ -383,7 +551,6 @@ void MainThread::search() {
   if(persistedSelfLearning){
 	  if ((((Movesplayed <= 40) || (piecesCnt <= 6)) && (bestThread->completedDepth > 4 * ONE_PLY)))
 	  {
-		  std::ofstream general("experience.bin", std::ofstream::app | std::ofstream::binary);
 		  ExpEntry tempExpEntry;
 		  tempExpEntry.depth = bestThread->completedDepth;
 		  tempExpEntry.hashkey = rootPos.key();
@@ -391,30 +558,16 @@ void MainThread::search() {
 		  tempExpEntry.score = bestThread->rootMoves[0].score;
 		  if (Movesplayed <= 10 && startpoint &&  piecesCnt > 6)
 		  {
-			  general.write((char*)&tempExpEntry, sizeof(tempExpEntry));
+			  ExpWriter.write("experience.bin", tempExpEntry);
 		  }
 		  if (startpoint &&  piecesCnt > 6)
 		  {
 			  for (int x = 0; x < openingswritten; x++)
-			  {
-				  string openings;
-				  char *opnings;
-	
-				  std::ostringstream ss;
-				  ss << OpFileKey[x];
-				  openings = ss.str() + ".bin";
-				  opnings = new char[openings.length() + 1];
-				  std::strcpy(opnings, openings.c_str());
-				  std::ofstream myFile(opnings, std::ofstream::app | std::ofstream::binary);
-				  myFile.write((char*)&tempExpEntry, sizeof(tempExpEntry));
-				  myFile.close();
-			  }
+				  ExpWriter.write(std::to_string(OpFileKey[x]) + ".bin", tempExpEntry);
 		  }
 		  if (piecesCnt <= 2)
 		  {
-			  std::ofstream pawngame("pawngame.bin", std::ofstream::app | std::ofstream::binary);
-			  pawngame.write((char*)&tempExpEntry, sizeof(tempExpEntry));
-			  pawngame.close();
+			  ExpWriter.write("pawngame.bin", tempExpEntry);
 		  }
 		  Movesplayed++;
 	
@@ -617,6 +770,9 @@ void Thread::search() {
   for (int i = 7; i > 0; i--)
      (ss-i)->continuationHistory = &this->continuationHistory[NO_PIECE][0]; // Use as sentinel
   ss->pv = pv;
+
+  if (perceptronSearch)
+      perceptron = SharedPerceptron; // Read-only while searching
   if(lessPruningMode)
   {
       bestValue = delta1 = delta2 = alpha = -VALUE_INFINITE;
@@ -656,6 +812,12 @@ void Thread::search() {
   contempt = (us == WHITE ?  make_score(ct, ct / 2)
                           : -make_score(ct, ct / 2));
 
+  if (mctsSearch)
+  {
+      uct_search(ss);
+      return;
+  }
+
   // Iterative deepening loop until requested to stop or the target depth is reached
   while (   (rootDepth += ONE_PLY) < DEPTH_MAX
          && !Threads.stop
@@ -665,6 +827,41 @@ void Thread::search() {
       if (mainThread)
           mainThread->bestMoveChanges *= 0.517;
 
+      // Distribute search depths across the helper threads
+      if (smpSkipBlocks && idx > 0)
+      {
+          int i = (idx - 1) % 20;
+          if (((rootDepth / ONE_PLY + SkipPhase[i]) / SkipSize[i]) % 2)
+              continue;
+      }
+
+      // With a root split, start from the lines searched by all the threads
+      bool split = multiPVSplit && multiPV > 1 && Threads.size() > 1;
+      if (split)
+          RootLines.merge(rootMoves, rootDepth);
+
+      // A thread takes the lines not taken yet at this depth. Then the main
+      // thread waits for the lines of the others, checking the time meanwhile,
+      // and searches the lines still missing, up to multiPV of them.
+      size_t repairs = 0;
+      auto next_line = [&]() {
+
+          size_t line = RootLines.take(rootDepth);
+
+          if (line < multiPV || !mainThread)
+              return line;
+
+          while (!RootLines.published(rootDepth, multiPV) && !Threads.stop)
+          {
+              std::this_thread::sleep_for(std::chrono::milliseconds(1));
+              mainThread->callsCnt = 0;
+              mainThread->check_time();
+          }
+
+          size_t fresh = RootLines.merge(rootMoves, rootDepth);
+          return fresh < multiPV && repairs++ < multiPV ? fresh : multiPV;
+      };
+
       // Save the last iteration's scores before first PV line is searched and
       // all the move scores except the (new) PV are set to -VALUE_INFINITE.
       for (RootMove& rm : rootMoves)
@@ -681,10 +878,23 @@ void Thread::search() {
 	  allScores = 0;
 	}
       //mcts Cardanobile from joergoster end
-      // MultiPV loop. We perform a full root search for each PV line
-      for (pvIdx = 0; pvIdx < multiPV && !Threads.stop; ++pvIdx)
+      // MultiPV loop. We perform a full root search for each PV line, or
+      // for each line taken from the root split.
+      for (pvIdx = split ? next_line() : 0;
+           pvIdx < multiPV && !Threads.stop;
+           pvIdx = split ? next_line() : pvIdx + 1)
       {
-          if (pvIdx == pvLast)
+          if (split) // The lines are taken in any order
+          {
+              for (pvFirst = pvIdx; pvFirst > 0; --pvFirst)
+                  if (rootMoves[pvFirst - 1].tbRank != rootMoves[pvIdx].tbRank)
+                      break;
+
+              for (pvLast = pvIdx + 1; pvLast < rootMoves.size(); pvLast++)
+                  if (rootMoves[pvLast].tbRank != rootMoves[pvIdx].tbRank)
+                      break;
+          }
+          else if (pvIdx == pvLast)
           {
               pvFirst = pvLast;
               for (pvLast++; pvLast < rootMoves.size(); pvLast++)
@@ -695,8 +905,15 @@ void Thread::search() {
           // Reset UCI info selDepth for each depth and each PV line
           selDepth = 0;
 
-          // Reset aspiration window starting size
-          if (rootDepth >= 5 * ONE_PLY)
+          // Reset aspiration window starting size. A line of a root split may
+          // have no score yet, if it was never searched by this thread nor
+          // published, then it is searched with a full window.
+          if (split && rootMoves[pvIdx].previousScore == -VALUE_INFINITE)
+          {
+              alpha = -VALUE_INFINITE;
+              beta  =  VALUE_INFINITE;
+          }
+          else if (rootDepth >= 5 * ONE_PLY)
           {
               Value previousScore = rootMoves[pvIdx].previousScore;
               //from Corchess
@@ -803,6 +1020,13 @@ void Thread::search() {
               assert(alpha >= -VALUE_INFINITE && beta <= VALUE_INFINITE);
           }
 
+          if (split)
+          {
+              if (!Threads.stop)
+                  RootLines.publish(rootMoves[pvIdx], rootDepth);
+              continue;
+          }
+
           // Sort the PV lines searched so far and update the GUI
           std::stable_sort(rootMoves.begin() + pvFirst, rootMoves.begin() + pvIdx + 1);
 
@@ -811,7 +1035,21 @@ void Thread::search() {
               sync_cout << UCI::pv(rootPos, rootDepth, alpha, beta) << sync_endl;
       }
 
-      if (!Threads.stop)
+      // Gather the lines of the other threads and update the GUI. A depth is
+      // complete when its first multiPV lines were all searched at this depth.
+      bool complete = !split;
+      if (split)
+      {
+          complete = RootLines.merge(rootMoves, rootDepth) >= multiPV;
+
+          if (rootMoves[0].score != -VALUE_INFINITE)
+              bestValue = rootMoves[0].score;
+
+          if (mainThread && complete && !Threads.stop)
+              sync_cout << UCI::pv(rootPos, rootDepth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
+      }
+
+      if (!Threads.stop && complete)
           completedDepth = rootDepth;
 
       if (rootMoves[0].pv[0] != lastBestMove) {
@@ -860,10 +1098,21 @@ void Thread::search() {
           }
       }
       //mcts cardanobile playout begin
-      if ((mainThread && !Threads.stop)
+      if (((mainThread || parallelPlayouts) && !Threads.stop)
 	  && (rootPos.this_thread()->shashinValue!=SHASHIN_POSITION_TAL) && (rootPos.this_thread()->shashinValue!=SHASHIN_POSITION_PETROSIAN) && perceptronSearch)
       {
-	  playout(lastBestMove, ss, bestValue);
+	  Move playMove = parallelPlayouts ? playout_move(rootMoves, idx) : lastBestMove;
+	  playout(playMove, ss, bestValue);
+
+	  // Credit the visits of the playout to the root move it started from
+	  auto rm = std::find(rootMoves.begin(), rootMoves.end(), playMove);
+	  if (rm != rootMoves.end() && !Threads.stop)
+	  {
+	      rm->visits += visits;
+	      rm->zScore += allScores;
+	  }
+	  visits = 0;
+	  allScores = 0;
       }
       //mcts cardanobile playout end
   }
@@ -900,13 +1149,14 @@ Value Thread::playout(Move playMove, Stack* ss, Value playoutValue) {
     (ss+1)->ply = ss->ply + 1;
     int d = int(rootDepth) * int(rootDepth) / (rootDepth + 4 * ONE_PLY) - 2;
 	Depth newDepth  = d * ONE_PLY;
-    TTEntry* tte    = TT.probe(rootPos.key(), ttHit);
+    TTEntry* ttWriter;
+    TTEntry tte     = TT.probe(rootPos.key(), ttHit, ttWriter);
 	if (!ttHit && MoveList<LEGAL>(rootPos).size()){
 	    playoutValue = ::search<NonPV>(rootPos, ss+1, - playoutValue,  - playoutValue + 1, newDepth, true);
-	    tte    = TT.probe(rootPos.key(), ttHit);
+	    tte    = TT.probe(rootPos.key(), ttHit, ttWriter);
 	   }
 
-    Move ttMove  = ttHit ? tte->move() : MOVE_NONE;
+    Move ttMove  = ttHit ? tte.move() : MOVE_NONE;
     if(  ttHit
       && ttMove != MOVE_NONE
       && ss->ply < MAX_PLY - 2
@@ -916,6 +1166,340 @@ Value Thread::playout(Move playMove, Stack* ss, Value playoutValue) {
     rootPos.undo_move(playMove);
 	return playoutValue;
 }
+
+namespace {
+
+  // Constants of the MCTS search mode
+  constexpr Depth UctProbeDepth = 2 * ONE_PLY; // Of the alpha-beta leaf probes
+  constexpr int UctMaxPly = MAX_PLY - 32;      // Leaves room for the probes
+  constexpr double UctCPuct = 1.5;             // Exploration constant of PUCT
+  constexpr double UctFpuReduction = 0.1;      // Unvisited edges look this worse
+
+  // uct_expand() creates the edges of a node, with the prior probabilities of
+  // the moves given by the usual move ordering hints: the TT move, the moves
+  // played before from the experience, the good captures, the checks and the
+  // history. At the root the edges are the root moves, to honour searchmoves.
+  bool uct_expand(Thread* th, Position& pos, UCT::Node* node, bool root) {
+
+    Move moves[MAX_MOVES];
+    size_t n = 0;
+
+    if (root)
+        for (const RootMove& rm : th->rootMoves)
+            moves[n++] = rm.pv[0];
+    else
+        for (const auto& m : MoveList<LEGAL>(pos))
+            moves[n++] = m;
+
+    if (!n)
+    {
+        node->edgeCount = 0;
+        return true;
+    }
+
+    UCT::Edge* edges = UCT::SearchTree.new_edges(node, n);
+    if (!edges)
+        return false;
+
+    bool ttHit;
+    TTEntry* ttWriter;
+    TTEntry tte = TT.probe(pos.key(), ttHit, ttWriter);
+    Move ttMove = ttHit ? tte.move() : MOVE_NONE;
+    Node expNode = persistedSelfLearning ? get_node(pos.key()) : nullptr;
+    Color us = pos.side_to_move();
+    float sum = 0;
+
+    for (size_t i = 0; i < n; ++i)
+    {
+        Move m = moves[i];
+        float w = 1.0f + 4.0f * (m == ttMove);
+
+        if (pos.capture_or_promotion(m))
+            w += 2.0f * pos.see_ge(m);
+        else
+            w += std::max(0, int(th->mainHistory[us][from_to(m)])) / 8192.0f;
+
+        w += 1.0f * pos.gives_check(m);
+
+        if (expNode)
+            for (int c = 0; c < expNode->sons; ++c)
+                if (expNode->child[c].move == m)
+                    w += 2.0f;
+
+        edges[i].move16 = uint16_t(m);
+        edges[i].prior = w;
+        edges[i].visits = edges[i].virtualLoss = 0;
+        edges[i].score = 0;
+        sum += w;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+        edges[i].prior /= sum;
+
+    return true;
+  }
+
+  // uct_select() returns the edge of an expanded node with the best PUCT value
+  UCT::Edge* uct_select(UCT::Node* node) {
+
+    UCT::Edge* edges = UCT::SearchTree.edges(node);
+    double parentVisits = node->visits.load(std::memory_order_relaxed);
+    double visitedScore = 0, visitedCount = 0;
+
+    for (uint32_t i = 0; i < node->edgeCount; ++i)
+    {
+        uint32_t n = edges[i].visits.load(std::memory_order_relaxed);
+        visitedScore += double(edges[i].score.load(std::memory_order_relaxed)) / UCT::Edge::ScoreScale;
+        visitedCount += n;
+    }
+
+    double fpu = (visitedCount ? visitedScore / visitedCount : 0.5) - UctFpuReduction;
+    double bestValue = -1;
+    UCT::Edge* best = edges;
+
+    for (uint32_t i = 0; i < node->edgeCount; ++i)
+    {
+        UCT::Edge& e = edges[i];
+        uint32_t n = e.visits.load(std::memory_order_relaxed)
+                   + e.virtualLoss.load(std::memory_order_relaxed);
+        double value = e.q(fpu) + UctCPuct * e.prior * std::sqrt(parentVisits + 1) / (1 + n);
+
+        if (value > bestValue)
+            bestValue = value, best = &e;
+    }
+
+    return best;
+  }
+
+  // uct_evaluate() returns the score of the side to move at a leaf of the tree,
+  // given by a short alpha-beta search.
+  double uct_evaluate(Thread* th, Position& pos, Stack* ss) {
+
+    Move pv[MAX_PLY+1];
+    ss->pv = pv;
+    th->rootDepth = ss->ply * ONE_PLY + UctProbeDepth;
+
+    return UCT::to_score(::search<PV>(pos, ss, -VALUE_INFINITE, VALUE_INFINITE, UctProbeDepth, false));
+  }
+
+  // uct_playout() runs a playout: it walks down the tree from the root, always
+  // taking the edge with the best PUCT value, expands the first node of the walk
+  // not expanded yet, evaluates it and backs the result up along the walk. It
+  // returns false if the root is not expanded yet by another thread.
+  bool uct_playout(Thread* th, Stack* ss) {
+
+    Position& pos = th->rootPos;
+    StateInfo st[UctMaxPly];
+    UCT::Edge* path[UctMaxPly];
+    int ply = 0;
+    double result; // Of the side to move at the end of the walk
+
+    while (true)
+    {
+        (ss+ply)->ply = ply;
+
+        if (ply && pos.is_draw(ply))
+        {
+            result = 0.5;
+            break;
+        }
+
+        bool found = false;
+        UCT::Node* node = ply < UctMaxPly - 1 ? UCT::SearchTree.find_or_insert(pos.key(), found) : nullptr;
+
+        // A new node is only evaluated, but the root is expanded at once
+        uint32_t state = node && (found || !ply) ? node->state.load(std::memory_order_acquire)
+                                                 : uint32_t(UCT::Node::Expanding);
+
+        if (   state == UCT::Node::Empty
+            && node->state.compare_exchange_strong(state, UCT::Node::Expanding, std::memory_order_acquire))
+        {
+            state = uct_expand(th, pos, node, !ply) ? UCT::Node::Expanded : UCT::Node::Empty;
+            node->state.store(state, std::memory_order_release);
+        }
+
+        if (state != UCT::Node::Expanded)
+        {
+            if (!ply)
+                return false;
+
+            result = uct_evaluate(th, pos, ss+ply);
+            break;
+        }
+
+        if (!node->edgeCount)
+        {
+            result = pos.checkers() ? 0.0 : 0.5;
+            break;
+        }
+
+        UCT::Edge* e = uct_select(node);
+        e->virtualLoss.fetch_add(1, std::memory_order_relaxed);
+        node->visits.fetch_add(1, std::memory_order_relaxed);
+        path[ply] = e;
+
+        (ss+ply)->currentMove = e->move();
+        (ss+ply)->continuationHistory = &th->continuationHistory[pos.moved_piece(e->move())][to_sq(e->move())];
+        pos.do_move(e->move(), st[ply++]);
+    }
+
+    // A probe interrupted by a stop returns garbage, so only virtual losses are removed
+    bool valid = !Threads.stop.load(std::memory_order_relaxed);
+
+    while (ply--)
+    {
+        result = 1.0 - result; // Of the side making the move
+        pos.undo_move(path[ply]->move());
+
+        if (valid)
+        {
+            path[ply]->score.fetch_add(uint64_t(result * UCT::Edge::ScoreScale + 0.5), std::memory_order_relaxed);
+            path[ply]->visits.fetch_add(1, std::memory_order_relaxed);
+        }
+        path[ply]->virtualLoss.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    return true;
+  }
+
+  // uct_update_root_moves() copies the statistics of the root edges into the root
+  // moves, sorted by visits as the most visited move is the one played. The PV of
+  // a root move follows the most visited edges down the tree, and when it ends
+  // with a mate or a stalemate, its score is that of the end. It returns the
+  // length of the best PV, reported as the depth of the search, and tells in
+  // ended whether the best PV reaches the end of the game.
+  int uct_update_root_moves(Thread* th, bool& ended) {
+
+    Position& pos = th->rootPos;
+    UCT::Node* root = UCT::SearchTree.find(pos.key());
+    ended = false;
+
+    if (!root || root->state.load(std::memory_order_acquire) != UCT::Node::Expanded)
+        return 0;
+
+    UCT::Edge* edges = UCT::SearchTree.edges(root);
+
+    for (RootMove& rm : th->rootMoves)
+        for (uint32_t i = 0; i < root->edgeCount; ++i)
+            if (edges[i].move() == rm.pv[0])
+            {
+                rm.visits = edges[i].visits.load(std::memory_order_relaxed);
+                rm.previousScore = rm.score;
+                rm.score = rm.visits ? UCT::to_value(edges[i].q(0)) : -VALUE_INFINITE;
+                rm.selDepth = th->selDepth;
+            }
+
+    std::stable_sort(th->rootMoves.begin(), th->rootMoves.end(),
+                     [](const RootMove& a, const RootMove& b) { return a.visits > b.visits; });
+
+    size_t multiPV = std::min(size_t(Options["MultiPV"]), th->rootMoves.size());
+    StateInfo st[UctMaxPly];
+
+    for (size_t i = 0; i < multiPV; ++i)
+    {
+        RootMove& rm = th->rootMoves[i];
+        rm.pv.resize(1);
+        pos.do_move(rm.pv[0], st[0]);
+
+        UCT::Node* node;
+        while (   rm.pv.size() < size_t(UctMaxPly)
+               && (node = UCT::SearchTree.find(pos.key()))
+               && node->state.load(std::memory_order_acquire) == UCT::Node::Expanded)
+        {
+            if (!node->edgeCount)
+            {
+                int ply = int(rm.pv.size());
+                rm.score = !pos.checkers() ? VALUE_DRAW : ply % 2 ? mate_in(ply) : mated_in(ply);
+                ended |= !i;
+                break;
+            }
+
+            UCT::Edge* e = UCT::SearchTree.edges(node);
+            UCT::Edge* best = std::max_element(e, e + node->edgeCount,
+                [](const UCT::Edge& a, const UCT::Edge& b) { return a.visits < b.visits; });
+
+            if (!best->visits)
+                break;
+
+            rm.pv.push_back(best->move());
+            pos.do_move(best->move(), st[rm.pv.size() - 1]);
+        }
+
+        for (size_t j = rm.pv.size(); j > 0; --j)
+            pos.undo_move(rm.pv[j - 1]);
+    }
+
+    th->pvIdx = multiPV - 1;
+    return int(th->rootMoves[0].pv.size());
+  }
+
+} // namespace
+
+
+/// Thread::uct_search() is the search of the "NN MCTS Search" mode, run by all
+/// the threads instead of the iterative deepening. The threads run playouts on
+/// the shared tree until stopped. The main thread also reports the PV, with the
+/// playouts per second, and stops the search at the end of the optimum time or
+/// when the PV reaches the requested depth.
+
+void Thread::uct_search(Stack* ss) {
+
+  MainThread* mainThread = (this == Threads.main() ? Threads.main() : nullptr);
+  TimePoint lastInfoTime = now();
+  int depth = 0;
+  bool ended = false;
+
+  while (!Threads.stop)
+  {
+      if (!uct_playout(this, ss))
+      {
+          std::this_thread::yield(); // The root is being expanded
+          continue;
+      }
+
+      uint64_t n = playouts.fetch_add(1, std::memory_order_relaxed) + 1;
+
+      if (!mainThread || n % 64)
+          continue;
+
+      depth = uct_update_root_moves(this, ended);
+      completedDepth = depth * ONE_PLY;
+
+      if (now() - lastInfoTime >= 1000)
+      {
+          lastInfoTime = now();
+          sync_cout << UCI::pv(rootPos, completedDepth, -VALUE_INFINITE, VALUE_INFINITE) << sync_endl;
+      }
+
+      if (Limits.depth && (depth >= Limits.depth || ended))
+          break;
+
+      if (   Limits.use_time_management()
+          && !mainThread->stopOnPonderhit
+          && (rootMoves.size() == 1 || Time.elapsed() > Time.optimum()))
+      {
+          if (mainThread->ponder)
+              mainThread->stopOnPonderhit = true;
+          else
+              Threads.stop = true;
+      }
+  }
+
+  if (!mainThread)
+      return;
+
+  depth = uct_update_root_moves(this, ended);
+  completedDepth = depth * ONE_PLY;
+
+  TimePoint elapsed = Time.elapsed() + 1;
+  uint64_t playoutsSearched = Threads.playouts_searched();
+
+  sync_cout << UCI::pv(rootPos, completedDepth, -VALUE_INFINITE, VALUE_INFINITE) << "\n"
+            << "info string playouts " << playoutsSearched
+            << " playouts/s " << playoutsSearched * 1000 / elapsed
+            << " nodes/s " << Threads.nodes_searched() * 1000 / elapsed
+            << " tree " << UCT::SearchTree.hashfull() << sync_endl;
+}
 namespace {
 
   // search<>() is the main search function for both PV and non-PV nodes
@@ -972,7 +1556,7 @@ namespace {
     Move pv[MAX_PLY+1], capturesSearched[32], quietsSearched[64];
     StateInfo st;
 	//from MateFinder
-    TTEntry* tte=NULL;
+    TTEntry tte, *ttWriter = nullptr;
     Key posKey=0;
 	//end from MateFinder
     Move ttMove, move, excludedMove=MOVE_NONE, bestMove,expttMove=MOVE_NONE;//from MateFinder and kellykynyama mcts
@@ -984,7 +1568,7 @@ namespace {
 
     //from perceptron_scratch  begin
     int moveCount, captureCount, quietCount, prediction;
-    float features[percInput] = {0.0, 0.0, 0.0, 0.0};
+    float features[Perceptron::Inputs] = {0.0, 0.0, 0.0, 0.0};
     bool trainPerc = false;
     //from perceptron_scratch end
 
@@ -1054,28 +1638,28 @@ namespace {
     // position key in case of an excluded move.
     excludedMove = ss->excludedMove;
     posKey = pos.key() ^ Key(excludedMove << 16); // Isn't a very good hash
-    tte = TT.probe(posKey, ttHit);
-    ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
+    tte = TT.probe(posKey, ttHit, ttWriter);
+    ttValue = ttHit ? value_from_tt(tte.value(), ss->ply) : VALUE_NONE;
     ttMove =  rootNode ? thisThread->rootMoves[thisThread->pvIdx].pv[0]
-            : ttHit    ? tte->move() : MOVE_NONE;
-    ttPv = (ttHit && tte->is_pv()) || (PvNode && depth > 4 * ONE_PLY);
+            : ttHit    ? tte.move() : MOVE_NONE;
+    ttPv = (ttHit && tte.is_pv()) || (PvNode && depth > 4 * ONE_PLY);
 
     // if position has been searched at higher depths and we are shuffling, return value_draw
     if (pos.rule50_count() > 36
         && ss->ply > 36
         && depth < 3 * ONE_PLY
         && ttHit
-        && tte->depth() > depth
+        && tte.depth() > depth
         && pos.count<PAWN>() > 0)
         return VALUE_DRAW;
 
     // At non-PV nodes we check for an early TT cutoff
     if (  !PvNode
         && ttHit
-        && tte->depth() >= depth
+        && tte.depth() >= depth
         && ttValue != VALUE_NONE // Possible in case of TT access race
-        && (ttValue >= beta ? (tte->bound() & BOUND_LOWER)
-                            : (tte->bound() & BOUND_UPPER)))
+        && (ttValue >= beta ? (tte.bound() & BOUND_LOWER)
+                            : (tte.bound() & BOUND_UPPER)))
     {
         // If ttMove is quiet, update move sorting heuristics on TT hit
         if (ttMove)
@@ -1129,7 +1713,8 @@ namespace {
 					bool ttMovehave = false;
 					if (ttMove)
 						ttMovehave = true;
-					expHits = true;
+					if (!expHits.load(std::memory_order_relaxed))
+						expHits.store(true, std::memory_order_relaxed); // Avoid a shared write per hit
 					expttHit = true;
 					Value myValue = -VALUE_INFINITE;
 					minSons = node->sons;
@@ -1156,12 +1741,12 @@ namespace {
 						&& child.depth >= depth
 						)
 					{
-						tte->save(posKey, child.score, ttPv, BOUND_EXACT, child.depth, child.move, child.score);
+						ttWriter->save(posKey, child.score, ttPv, BOUND_EXACT, child.depth, child.move, child.score);
 	
-						tte = TT.probe(posKey, ttHit);
-						ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
+						tte = TT.probe(posKey, ttHit, ttWriter);
+						ttValue = ttHit ? value_from_tt(tte.value(), ss->ply) : VALUE_NONE;
 						ttMove = rootNode ? thisThread->rootMoves[thisThread->pvIdx].pv[0]
-							: ttHit ? tte->move() : MOVE_NONE;
+							: ttHit ? tte.move() : MOVE_NONE;
 					}
 					if (!PvNode && updated
 						&& child.depth >= depth
@@ -1237,7 +1822,7 @@ namespace {
                 if (    b == BOUND_EXACT
                     || (b == BOUND_LOWER ? value >= beta : value <= alpha))
                 {
-                    tte->save(posKey, value_to_tt(value, ss->ply), ttPv, b,
+                    ttWriter->save(posKey, value_to_tt(value, ss->ply), ttPv, b,
                               std::min(DEPTH_MAX - ONE_PLY, depth + 6 * ONE_PLY),
                               MOVE_NONE, VALUE_NONE);
                     //mcts Cardanobile from joergoster begin
@@ -1271,13 +1856,13 @@ namespace {
     else if (ttHit)
     {
         // Never assume anything on values stored in TT
-        ss->staticEval = eval = pureStaticEval = tte->eval();
+        ss->staticEval = eval = pureStaticEval = tte.eval();
         if (eval == VALUE_NONE)
             ss->staticEval = eval = pureStaticEval = evaluate(pos);
 
         // Can ttValue be used as a better position evaluation?
         if (    ttValue != VALUE_NONE
-            && (tte->bound() & (ttValue > eval ? BOUND_LOWER : BOUND_UPPER)))
+            && (tte.bound() & (ttValue > eval ? BOUND_LOWER : BOUND_UPPER)))
             eval = ttValue;
     }
     else
@@ -1303,7 +1888,7 @@ namespace {
 			else{
 			    ss->staticEval = eval = pureStaticEval = -(ss-1)->staticEval + 2 * Eval::Tempo;
 			}
-			tte->save(posKey, VALUE_NONE, ttPv, BOUND_NONE, DEPTH_NONE, MOVE_NONE, pureStaticEval);
+			ttWriter->save(posKey, VALUE_NONE, ttPv, BOUND_NONE, DEPTH_NONE, MOVE_NONE, pureStaticEval);
 		}
 	}
 	//kellykyniama mcts end
@@ -1465,9 +2050,9 @@ namespace {
     {
         search<NT>(pos, ss, alpha, beta, depth - 7 * ONE_PLY, cutNode);
 
-        tte = TT.probe(posKey, ttHit);
-        ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
-        ttMove = ttHit ? tte->move() : MOVE_NONE;
+        tte = TT.probe(posKey, ttHit, ttWriter);
+        ttValue = ttHit ? value_from_tt(tte.value(), ss->ply) : VALUE_NONE;
+        ttMove = ttHit ? tte.move() : MOVE_NONE;
     }
 
 moves_loop: // When in check, search starts from here
@@ -1488,6 +2073,9 @@ moves_loop: // When in check, search starts from here
     moveCountPruning = false;
     ttCapture = ttMove && pos.capture_or_promotion(ttMove);
 
+    // Mark this node as being searched
+    ThreadHolding th(thisThread, posKey, ss->ply);
+
     // Step 12. Loop through all pseudo-legal moves until no moves remain
     // or a beta cutoff occurs.
     while ((move = mp.next_move(moveCountPruning)) != MOVE_NONE)
@@ -1542,8 +2130,8 @@ moves_loop: // When in check, search starts from here
           && !excludedMove // Avoid recursive singular search
       /*  &&  ttValue != VALUE_NONE Already implicit in the next condition */
           &&  abs(ttValue) < VALUE_KNOWN_WIN
-          && (tte->bound() & BOUND_LOWER)
-          &&  tte->depth() >= depth - 3 * ONE_PLY
+          && (tte.bound() & BOUND_LOWER)
+          &&  tte.depth() >= depth - 3 * ONE_PLY
           &&  pos.legal(move))
       {
           Value singularBeta = ttValue - 2 * depth / ONE_PLY;
@@ -1669,6 +2257,10 @@ moves_loop: // When in check, search starts from here
           if ((ss-1)->moveCount > 15)
               r -= ONE_PLY;
 
+          // Increase reduction if other threads are searching this position
+          if (th.marked())
+              r += ONE_PLY;
+
           if (!captureOrPromotion)
           {
               // Increase reduction if ttMove is a capture (~0 Elo)
@@ -1734,7 +2326,7 @@ moves_loop: // When in check, search starts from here
 		features[1] = float(ss->statScore);
 		features[2] = float(moveCount);
 		features[3] = float(int(r));
-		prediction  = infer(features);
+		prediction  = thisThread->perceptron.infer(features);
   		trainPerc = true;
                 // Decrease/increase reduction for moves with a good/bad history (~30 Elo)
   		if((pos.this_thread()->shashinValue!=SHASHIN_POSITION_TAL)
@@ -1759,10 +2351,9 @@ moves_loop: // When in check, search starts from here
           if (trainPerc && perceptronSearch){
              int result = value > alpha;
              if (prediction != result){
-                train(features, 1e-2);
+                thisThread->perceptron.train(features, 1e-2);
              }
              trainPerc = false;
-             dbg_hit_on(prediction == result);
           }
 
           doFullDepthSearch = (value > alpha && d != newDepth);
@@ -1912,7 +2503,7 @@ moves_loop: // When in check, search starts from here
         bestValue = std::min(bestValue, maxValue);
 
     if (!excludedMove)
-        tte->save(posKey, value_to_tt(bestValue, ss->ply), ttPv,
+        ttWriter->save(posKey, value_to_tt(bestValue, ss->ply), ttPv,
                   bestValue >= beta ? BOUND_LOWER :
                   PvNode && bestMove ? BOUND_EXACT : BOUND_UPPER,
                   depth, bestMove, pureStaticEval);
@@ -1943,7 +2534,7 @@ moves_loop: // When in check, search starts from here
 
     Move pv[MAX_PLY+1];
     StateInfo st;
-    TTEntry* tte;
+    TTEntry tte, *ttWriter;
     Key posKey;
     Move ttMove, move, bestMove;
     Depth ttDepth;
@@ -1979,17 +2570,17 @@ moves_loop: // When in check, search starts from here
                                                   : DEPTH_QS_NO_CHECKS;
     // Transposition table lookup
     posKey = pos.key();
-    tte = TT.probe(posKey, ttHit);
-    ttValue = ttHit ? value_from_tt(tte->value(), ss->ply) : VALUE_NONE;
-    ttMove = ttHit ? tte->move() : MOVE_NONE;
-    pvHit = ttHit && tte->is_pv();
+    tte = TT.probe(posKey, ttHit, ttWriter);
+    ttValue = ttHit ? value_from_tt(tte.value(), ss->ply) : VALUE_NONE;
+    ttMove = ttHit ? tte.move() : MOVE_NONE;
+    pvHit = ttHit && tte.is_pv();
 
     if (  !PvNode
         && ttHit
-        && tte->depth() >= ttDepth
+        && tte.depth() >= ttDepth
         && ttValue != VALUE_NONE // Only in case of TT access race
-        && (ttValue >= beta ? (tte->bound() & BOUND_LOWER)
-                            : (tte->bound() & BOUND_UPPER)))
+        && (ttValue >= beta ? (tte.bound() & BOUND_LOWER)
+                            : (tte.bound() & BOUND_UPPER)))
         return ttValue;
 
     // Evaluate the position statically
@@ -2000,27 +2591,36 @@ moves_loop: // When in check, search starts from here
     }
     else
     {
+        // Only a fail high matters to the stand pat, so the staged evaluation
+        // may stop early at beta. Its value is then a bound, not kept as the
+        // static evaluation.
         if (ttHit)
         {
             // Never assume anything on values stored in TT
-            if ((ss->staticEval = bestValue = tte->eval()) == VALUE_NONE)
-                ss->staticEval = bestValue = evaluate(pos);
+            if ((ss->staticEval = bestValue = tte.eval()) == VALUE_NONE)
+            {
+                bestValue = evaluate(pos, -VALUE_INFINITE, beta);
+                ss->staticEval = bestValue < beta ? bestValue : VALUE_NONE;
+            }
 
             // Can ttValue be used as a better position evaluation?
             if (    ttValue != VALUE_NONE
-                && (tte->bound() & (ttValue > bestValue ? BOUND_LOWER : BOUND_UPPER)))
+                && (tte.bound() & (ttValue > bestValue ? BOUND_LOWER : BOUND_UPPER)))
                 bestValue = ttValue;
         }
+        else if ((ss-1)->currentMove != MOVE_NULL)
+        {
+            bestValue = evaluate(pos, -VALUE_INFINITE, beta);
+            ss->staticEval = bestValue < beta ? bestValue : VALUE_NONE;
+        }
         else
-            ss->staticEval = bestValue =
-            (ss-1)->currentMove != MOVE_NULL ? evaluate(pos)
-                                             : -(ss-1)->staticEval + 2 * Eval::Tempo;
+            ss->staticEval = bestValue = -(ss-1)->staticEval + 2 * Eval::Tempo;
 
         // Stand pat. Return immediately if static value is at least beta
         if (bestValue >= beta)
         {
             if (!ttHit)
-                tte->save(posKey, value_to_tt(bestValue, ss->ply), pvHit, BOUND_LOWER,
+                ttWriter->save(posKey, value_to_tt(bestValue, ss->ply), pvHit, BOUND_LOWER,
                           DEPTH_NONE, MOVE_NONE, ss->staticEval);
 
             return bestValue;
@@ -2136,7 +2736,7 @@ moves_loop: // When in check, search starts from here
     if (inCheck && bestValue == -VALUE_INFINITE)
         return mated_in(ss->ply); // Plies to mate from the root
 
-    tte->save(posKey, value_to_tt(bestValue, ss->ply), pvHit,
+    ttWriter->save(posKey, value_to_tt(bestValue, ss->ply), pvHit,
               bestValue >= beta ? BOUND_LOWER :
               PvNode && bestValue > oldAlpha  ? BOUND_EXACT : BOUND_UPPER,
               ttDepth, bestMove, ss->staticEval);
@@ -2333,9 +2933,13 @@ string UCI::pv(const Position& pos, Depth depth, Value alpha, Value beta) {
       if (depth == ONE_PLY && !updated)
           continue;
 
-      Depth d = updated ? depth : depth - ONE_PLY;
+      Depth d = !updated                ? depth - ONE_PLY
+              : rootMoves[i].splitDepth ? rootMoves[i].splitDepth : depth;
       Value v = updated ? rootMoves[i].score : rootMoves[i].previousScore;
 
+      if (v == -VALUE_INFINITE) // A line of a root split not searched yet
+          continue;
+
       bool tb = TB::RootInTB && abs(v) < VALUE_MATE - MAX_PLY;
       v = tb ? rootMoves[i].tbScore : v;
 
@@ -2385,11 +2989,12 @@ bool RootMove::extract_ponder_from_tt(Position& pos) {
         return false;
 
     pos.do_move(pv[0], st);
-    TTEntry* tte = TT.probe(pos.key(), ttHit);
+    TTEntry* ttWriter;
+    TTEntry tte = TT.probe(pos.key(), ttHit, ttWriter);
 
     if (ttHit)
     {
-        Move m = tte->move(); // Local copy to be SMP safe
+        Move m = tte.move(); // Local copy to be SMP safe
         if (MoveList<LEGAL>(pos).contains(m))
             pv.push_back(m);
     }
@@ -73,6 +73,7 @@ struct RootMove {
   int64_t visits = 0;
   //mcts Cardanobile from joergoster end
   int selDepth = 0;
+  Depth splitDepth = DEPTH_ZERO; // Depth of the line, with a root split
   int tbRank;
   Value tbScore;
   std::vector<Move> pv;
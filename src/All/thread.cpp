@@ -26,6 +26,7 @@
 #include "uci.h"
 #include "syzygy/tbprobe.h"
 #include "tt.h"
+#include "uct.h"
 
 ThreadPool Threads; // Global object
 
@@ -87,6 +88,47 @@ void Thread::wait_for_search_finished() {
 }
 
 
+/// MainThread::wait_for_stop() blocks on a condition variable, once the search
+/// is over, until the GUI sends "stop" or "ponderhit" if we are pondering or in
+/// an infinite search, as the UCI protocol forbids sending the best move before.
+
+void MainThread::wait_for_stop() {
+
+  std::unique_lock<Mutex> lk(stopMutex);
+  stopCv.wait(lk, [&]{ return Threads.stop || !(ponder || Search::Limits.infinite); });
+}
+
+
+/// MainThread::stop_search() and MainThread::ponderhit() handle the "stop" and
+/// "ponderhit" commands, waking up the main thread in wait_for_stop().
+
+void MainThread::stop_search() {
+
+  std::lock_guard<Mutex> lk(stopMutex);
+  Threads.stop = true;
+  stopCv.notify_one();
+}
+
+void MainThread::ponderhit() {
+
+  std::lock_guard<Mutex> lk(stopMutex);
+  ponder = false; // Switch to normal search
+  stopCv.notify_one();
+}
+
+
+/// Thread::resize_tables() allocates the pawn, material and evaluation tables
+/// of the thread at the sizes set by the UCI options.
+
+void Thread::resize_tables() {
+
+  pawnsTable.resize(Options["Pawn Hash"]);
+  materialTable.resize(Options["Material Hash"]);
+  evalCache.resize(Options["Eval Cache"]);
+  resizeTables = false;
+}
+
+
 /// Thread::idle_loop() is where the thread is parked, blocked on the
 /// condition variable, when it has no work to do.
 
@@ -100,6 +142,13 @@ void Thread::idle_loop() {
   if (Options["Threads"] > 8)
       WinProcGroup::bindThisThread(idx);
 
+  // Now that we run on our node, allocate the pawn, material and evaluation
+  // tables and touch the histories first, so that on a system with a
+  // first-touch policy their pages are local to the node instead of to the
+  // thread creating us.
+  resize_tables();
+  clear();
+
   while (true)
   {
       std::unique_lock<Mutex> lk(mutex);
@@ -112,32 +161,49 @@ void Thread::idle_loop() {
 
       lk.unlock();
 
+      // A table size changed while we were idle: resize our tables here,
+      // before the search probes them, rather than from the UCI thread.
+      if (resizeTables)
+          resize_tables();
+
       search();
   }
 }
 
 /// ThreadPool::set() creates/destroys threads to match the requested number.
 /// Created and launched threads will immediately go to sleep in idle_loop.
-/// Upon resizing, threads are recreated to allow for binding if necessary.
+/// The pool grows and shrinks incrementally, keeping the existing threads,
+/// except when it grows past 8 threads: the threads bind themselves to a NUMA
+/// node only when created in such a pool, so they are all recreated then.
 
 void ThreadPool::set(size_t requested) {
 
-  if (size() > 0) { // destroy any existing thread(s)
+  if (size() > 0) { // destroy the thread(s) in excess
       main()->wait_for_search_finished();
 
-      while (size() > 0)
+      size_t keep = requested > 8 && size() <= 8 ? 0 : requested;
+
+      while (size() > keep)
           delete back(), pop_back();
   }
 
   if (requested > 0) { // create new thread(s)
-      push_back(new MainThread(0));
+      bool recreated = empty();
+
+      if (recreated)
+          push_back(new MainThread(0));
 
       while (size() < requested)
           push_back(new Thread(size()));
       clear();
 
-      // Reallocate the hash with the new threadpool size
-      TT.resize(Options["Hash"]);
+      // Reallocate the hash only with a new pool, so that its pages get spread
+      // over the nodes by the threads clearing it.
+      if (recreated)
+      {
+          TT.resize(Options["Hash"]);
+          UCT::SearchTree.resize(Options["MCTS Tree Size"]);
+      }
   }
 }
 
@@ -190,7 +256,7 @@ void ThreadPool::start_thinking(Position& pos, StateListPtr& states,
 
   for (Thread* th : *this)
   {
-      th->nodes = th->tbHits = th->nmpMinPly = 0;
+      th->nodes = th->tbHits = th->playouts = th->nmpMinPly = 0;
       th->rootDepth = th->completedDepth = DEPTH_ZERO;
       th->rootMoves = rootMoves;
       th->rootPos.set(pos.fen(), pos.is_chess960(), &setupStates->back(), th);
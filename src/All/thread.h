@@ -27,9 +27,11 @@
 #include <thread>
 #include <vector>
 
+#include "evaluate.h"
 #include "material.h"
 #include "movepick.h"
 #include "pawns.h"
+#include "perceptron.h"
 #include "position.h"
 #include "search.h"
 #include "thread_win32_osx.h"
@@ -46,7 +48,7 @@ class Thread {
   ConditionVariable cv;
   size_t idx;
   bool exit = false, searching = true; // Set before starting std::thread
-  NativeThread stdThread;
+  void resize_tables();
 
 public:
   explicit Thread(size_t);
@@ -58,18 +60,21 @@ public:
   //end from Shashin
   void clear();
   virtual Value playout(Move, Search::Stack*, Value);//playout
+  void uct_search(Search::Stack* ss);
   void idle_loop();
   void start_searching();
   void wait_for_search_finished();
 
+  bool resizeTables = false; // Set while idle, the thread resizes its own tables
   Pawns::Table pawnsTable;
   Material::Table materialTable;
+  Eval::Cache evalCache;
   Endgames endgames;
   size_t pvIdx, pvLast;
   int selDepth, nmpMinPly;
   int64_t visits, allScores; //mcts Cardanobile from joergoster
   Color nmpColor;
-  std::atomic<uint64_t> nodes, tbHits;
+  std::atomic<uint64_t> nodes, tbHits, playouts;
 
   Position rootPos;
   Search::RootMoves rootMoves;
@@ -78,11 +83,17 @@ public:
   ButterflyHistory mainHistory;
   CapturePieceToHistory captureHistory;
   ContinuationHistory continuationHistory;
+  Search::Perceptron perceptron;
   Score contempt;
   //from Shashin
   uint8_t shashinValue;
   int shashinContempt,shashinQuiescentCapablancaMaxScore,shashinMaxLmr;
   //end from Shashin
+
+private:
+  // Declared last, so that the thread starts in idle_loop() only once all the
+  // other members, which it allocates and clears, are constructed.
+  NativeThread stdThread;
  };
 
 
@@ -94,12 +105,19 @@ struct MainThread : public Thread {
 
   void search() override;
   void check_time();
+  void wait_for_stop();
+  void stop_search();
+  void ponderhit();
 
   double bestMoveChanges, previousTimeReduction;
   Value previousScore;
   int callsCnt;
   bool stopOnPonderhit;
   std::atomic_bool ponder;
+
+private:
+  Mutex stopMutex;
+  ConditionVariable stopCv;
 };
 
 
@@ -116,6 +134,7 @@ struct ThreadPool : public std::vector<Thread*> {
   MainThread* main()        const { return static_cast<MainThread*>(front()); }
   uint64_t nodes_searched() const { return accumulate(&Thread::nodes); }
   uint64_t tb_hits()        const { return accumulate(&Thread::tbHits); }
+  uint64_t playouts_searched() const { return accumulate(&Thread::playouts); }
 
   std::atomic_bool stop;
 
@@ -18,10 +18,27 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <algorithm>
+#include <cstdio>    // For std::rename
 #include <cstring>   // For std::memset
+#include <iomanip>
 #include <iostream>
+#include <queue>
+#include <sstream>
 #include <thread>
 #include <fstream> //from kellykynyama mcts
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
 #include "bitboard.h"
 #include "misc.h"
 #include "thread.h"
@@ -34,6 +51,8 @@ using namespace std;
 TranspositionTable EXP; // Our global transposition table
 
 MCTSHashTable MCTS;
+ExperienceFile ExpFile;
+ExperienceWriter ExpWriter;
 //from kellykynyama end
 
 TranspositionTable TT; // Our global transposition table
@@ -41,6 +60,8 @@ TranspositionTable TT; // Our global transposition table
 /// TTEntry::save populates the TTEntry with a new node's data, possibly
 /// overwriting an old position. Update is not atomic and can be racy.
 
+#ifndef USE_TT_XOR
+
 void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev) {
 
   assert(d / ONE_PLY * ONE_PLY == d);
@@ -62,19 +83,60 @@ void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev)
   }
 }
 
+#else
+
+/// With USE_TT_XOR the entry is written as a whole, so that a racing reader
+/// sees either a consistent entry or one whose check word does not verify.
+
+void TTEntry::save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev) {
+
+  assert(d / ONE_PLY * ONE_PLY == d);
+
+  uint64_t old = data;
+  bool sameKey = (check ^ old) == k;
+
+  // Preserve any existing move for the same position
+  uint64_t move16 = m || !sameKey ? uint16_t(m) : (old >> 48);
+
+  // Overwrite less valuable entries
+  if (   !sameKey
+      || d / ONE_PLY > int8_t(old) - 4
+      || b == BOUND_EXACT)
+      store(k,  move16 << 48
+              | uint64_t(uint16_t(v))  << 32
+              | uint64_t(uint16_t(ev)) << 16
+              | uint64_t(uint8_t(TT.generation8 | uint8_t(pv) << 2 | b)) << 8
+              | uint8_t(d / ONE_PLY));
+
+  else if (move16 != (old >> 48))
+      store(k, (old & 0xFFFFFFFFFFFFULL) | move16 << 48);
+}
+
+#endif
+
 
 /// TranspositionTable::resize() sets the size of the transposition table,
 /// measured in megabytes. Transposition table consists of a power of 2 number
 /// of clusters and each cluster consists of ClusterSize number of TTEntry.
+/// The table is backed by huge pages when the OS grants them, to cut the TLB
+/// misses of probe() on big hash sizes.
 
-void TranspositionTable::resize(size_t mbSize) {
+template<int ClusterSize, int ClusterBytes>
+void BasicTranspositionTable<ClusterSize, ClusterBytes>::resize(size_t mbSize) {
 
   Threads.main()->wait_for_search_finished();
 
+  large_pages_free(mem, clusterCount * sizeof(Cluster), largePages);
+
   clusterCount = mbSize * 1024 * 1024 / sizeof(Cluster);
+  mbCount = mbSize;
+  mem = nullptr;
+  largePages = NO_LARGE_PAGES;
 
-  free(mem);
-  mem = malloc(clusterCount * sizeof(Cluster) + CacheLineSize - 1);
+  if (!clusterCount)
+      return;
+
+  mem = large_pages_alloc(clusterCount * sizeof(Cluster), largePages);
 
   if (!mem)
   {
@@ -83,15 +145,20 @@ void TranspositionTable::resize(size_t mbSize) {
       exit(EXIT_FAILURE);
   }
 
-  table = (Cluster*)((uintptr_t(mem) + CacheLineSize - 1) & ~(CacheLineSize - 1));
+  table = static_cast<Cluster*>(mem);
+  assert((uintptr_t(table) & (CacheLineSize - 1)) == 0);
+
   clear();
 }
 
 
 /// TranspositionTable::clear() initializes the entire transposition table to zero,
-//  in a multi-threaded way.
+//  in a multi-threaded way. Each zeroing thread is bound like the search thread
+//  with the same index, so that with a first-touch policy each slice of the
+//  table ends up on the NUMA node of the threads that will use it most.
 
-void TranspositionTable::clear() {
+template<int ClusterSize, int ClusterBytes>
+void BasicTranspositionTable<ClusterSize, ClusterBytes>::clear() {
 
   std::vector<std::thread> threads;
 
@@ -117,25 +184,200 @@ void TranspositionTable::clear() {
       th.join();
 }
 
+namespace {
+
+/// A hash file is a HashFileHeader followed by the raw Cluster array. The
+/// header records what is needed to check that the table was written by a
+/// compatible build and to restore the search generation.
+
+constexpr char HashFileMagic[8] = "SHASHTT";
+constexpr uint32_t HashFileVersion = 2;
+
+struct HashFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t clusterBytes; // sizeof(Cluster), differs between TT layouts
+  uint64_t mbSize;
+  uint64_t clusterCount;
+  uint8_t generation8;
+  uint8_t clusterSize;   // Entries per cluster, differs between TT geometries
+  uint8_t padding[6];
+};
+
+} // namespace
+
+
+/// TranspositionTable::save() writes the whole table to the given file, so
+/// that a long analysis can be resumed later with load().
+
+template<int ClusterSize, int ClusterBytes>
+bool BasicTranspositionTable<ClusterSize, ClusterBytes>::save(const std::string& fname) const {
+
+  Threads.main()->wait_for_search_finished();
+
+  std::ofstream file(fname, std::ios::out | std::ios::binary | std::ios::trunc);
+
+  HashFileHeader h = {};
+  std::memcpy(h.magic, HashFileMagic, sizeof(h.magic));
+  h.version = HashFileVersion;
+  h.clusterBytes = sizeof(Cluster);
+  h.clusterSize = ClusterSize;
+  h.mbSize = mbCount;
+  h.clusterCount = clusterCount;
+  h.generation8 = generation8;
+
+  file.write((const char*)&h, sizeof(h));
+
+  // Write in chunks, a single write() of several GB is not portable
+  constexpr size_t Chunk = 64 * 1024 * 1024;
+  const char* data = (const char*)table;
+  for (size_t done = 0, size = clusterCount * sizeof(Cluster); done < size && file; done += Chunk)
+      file.write(data + done, std::min(Chunk, size - done));
+
+  file.close();
+
+  if (!file)
+      sync_cout << "info string Could not save hash to " << fname << sync_endl;
+  else
+      sync_cout << "info string Hash saved to " << fname << sync_endl;
+
+  return bool(file);
+}
+
+
+/// TranspositionTable::load() restores a table written by save(), resizing
+/// the hash to the size found in the file. Where available the file is mapped
+/// in memory and copied into the table by the same threads, with the same
+/// binding, used by clear().
+
+template<int ClusterSize, int ClusterBytes>
+bool BasicTranspositionTable<ClusterSize, ClusterBytes>::load(const std::string& fname) {
+
+  Threads.main()->wait_for_search_finished();
+
+  HashFileHeader h;
+  std::ifstream file(fname, std::ios::in | std::ios::binary);
+
+  if (   !file.read((char*)&h, sizeof(h))
+      ||  std::memcmp(h.magic, HashFileMagic, sizeof(h.magic))
+      ||  h.version != HashFileVersion
+      ||  h.clusterBytes != sizeof(Cluster)
+      ||  h.clusterSize != ClusterSize
+      ||  h.clusterCount != h.mbSize * 1024 * 1024 / sizeof(Cluster))
+  {
+      sync_cout << "info string " << fname << " is not a valid hash file" << sync_endl;
+      return false;
+  }
+
+  // Resize through the option, so that the GUI sees the new Hash value
+  if (h.mbSize != mbCount)
+      Options["Hash"] = std::to_string(h.mbSize);
+
+  if (h.mbSize != mbCount)
+  {
+      sync_cout << "info string Hash size " << h.mbSize << " MB out of range" << sync_endl;
+      return false;
+  }
+
+  const size_t size = clusterCount * sizeof(Cluster);
+  bool ok = false;
+
+#ifndef _WIN32
+
+  file.close();
+  int fd = open(fname.c_str(), O_RDONLY);
+  struct stat st;
+
+  if (fd != -1 && !fstat(fd, &st) && size_t(st.st_size) >= sizeof(h) + size)
+  {
+      void* map = mmap(nullptr, sizeof(h) + size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+      if (map != MAP_FAILED)
+      {
+          const char* data = (const char*)map + sizeof(h);
+          std::vector<std::thread> threads;
+
+          for (size_t idx = 0; idx < Options["Threads"]; ++idx)
+              threads.emplace_back([this, idx, data]() {
+
+                  if (Options["Threads"] > 8)
+                      WinProcGroup::bindThisThread(idx);
+
+                  const size_t stride = clusterCount / Options["Threads"],
+                               start  = stride * idx,
+                               len    = idx != Options["Threads"] - 1 ?
+                                        stride : clusterCount - start;
+
+                  std::memcpy(&table[start], data + start * sizeof(Cluster), len * sizeof(Cluster));
+              });
+
+          for (std::thread& th: threads)
+              th.join();
+
+          munmap(map, sizeof(h) + size);
+          ok = true;
+      }
+  }
+
+  if (fd != -1)
+      close(fd);
+
+#else
+
+  constexpr size_t Chunk = 64 * 1024 * 1024;
+  char* data = (char*)table;
+  for (size_t done = 0; done < size && file; done += Chunk)
+      file.read(data + done, std::min(Chunk, size - done));
+
+  ok = bool(file);
+
+#endif
+
+  if (!ok)
+  {
+      clear();
+      sync_cout << "info string Could not load hash from " << fname << sync_endl;
+      return false;
+  }
+
+  generation8 = h.generation8;
+  sync_cout << "info string Hash loaded from " << fname << sync_endl;
+  return true;
+}
+
+
 /// TranspositionTable::probe() looks up the current position in the transposition
-/// table. It returns true and a pointer to the TTEntry if the position is found.
-/// Otherwise, it returns false and a pointer to an empty or least valuable TTEntry
-/// to be replaced later. The replace value of an entry is calculated as its depth
+/// table. It returns a copy of the entry, read once, so that the caller sees the
+/// fields of a single save() even if another thread writes the entry meanwhile,
+/// and sets 'writer' to the entry to pass the new data to with save(). If the
+/// position is not found, 'writer' is an empty or least valuable TTEntry to be
+/// replaced later. The replace value of an entry is calculated as its depth
 /// minus 8 times its relative age. TTEntry t1 is considered more valuable than
 /// TTEntry t2 if its replace value is greater than that of t2.
 
-TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
+template<int ClusterSize, int ClusterBytes>
+TTEntry BasicTranspositionTable<ClusterSize, ClusterBytes>::probe(const Key key, bool& found, TTEntry*& writer) const {
 
   TTEntry* const tte = first_entry(key);
-  const uint16_t key16 = key >> 48;  // Use the high 16 bits as key inside the cluster
 
   for (int i = 0; i < ClusterSize; ++i)
-      if (!tte[i].key16 || tte[i].key16 == key16)
+  {
+      const TTEntry e = tte[i]; // Snapshot, all the checks and reads use it
+
+      if (e.empty() || e.matches(key))
       {
-          tte[i].genBound8 = uint8_t(generation8 | (tte[i].genBound8 & 0x7)); // Refresh
+          if ((e.gen_bound() & 0xF8) != generation8)
+              tte[i].refresh(e, generation8); // Refresh
 
-          return found = (bool)tte[i].key16, &tte[i];
+          writer = &tte[i];
+          return found = !e.empty(), e;
       }
+#ifdef USE_TT_XOR
+      // Count the entries the 16 bit key check would have wrongly accepted
+      else if ((e.key() >> 48) == (key >> 48))
+          keyCollisions.fetch_add(1, std::memory_order_relaxed);
+#endif
+  }
 
   // Find an entry to be replaced according to the replacement strategy
   TTEntry* replace = tte;
@@ -144,62 +386,229 @@ TTEntry* TranspositionTable::probe(const Key key, bool& found) const {
       // nature we add 263 (256 is the modulus plus 7 to keep the unrelated
       // lowest three bits from affecting the result) to calculate the entry
       // age correctly even after generation8 overflows into the next cycle.
-      if (  replace->depth8 - ((263 + generation8 - replace->genBound8) & 0xF8)
-          >   tte[i].depth8 - ((263 + generation8 -   tte[i].genBound8) & 0xF8))
+      if (  replace->depth_raw() - ((263 + generation8 - replace->gen_bound()) & 0xF8)
+          >   tte[i].depth_raw() - ((263 + generation8 -   tte[i].gen_bound()) & 0xF8))
           replace = &tte[i];
 
-  return found = false, replace;
+  writer = replace;
+  return found = false, *replace;
 }
 
 
 /// TranspositionTable::hashfull() returns an approximation of the hashtable
 /// occupation during a search. The hash is x permill full, as per UCI protocol.
 
-int TranspositionTable::hashfull() const {
+template<int ClusterSize, int ClusterBytes>
+int BasicTranspositionTable<ClusterSize, ClusterBytes>::hashfull() const {
 
   int cnt = 0;
   for (int i = 0; i < 1000 / ClusterSize; ++i)
       for (int j = 0; j < ClusterSize; ++j)
-          cnt += (table[i].entry[j].genBound8 & 0xF8) == generation8;
+          cnt += (table[i].entry[j].gen_bound() & 0xF8) == generation8;
 
   return cnt * 1000 / (ClusterSize * (1000 / ClusterSize));
 }
 
+
+/// TranspositionTable::info() tells the size of the table and whether it got
+/// huge pages from the OS, as sent to the GUI in an info string.
+
+template<int ClusterSize, int ClusterBytes>
+std::string BasicTranspositionTable<ClusterSize, ClusterBytes>::info() const {
+
+  return "Hash: " + std::to_string(mbCount) + " MB, " + pages();
+}
+
+template<int ClusterSize, int ClusterBytes>
+const char* BasicTranspositionTable<ClusterSize, ClusterBytes>::pages() const {
+
+  return largePages == EXPLICIT_LARGE_PAGES    ? "explicit huge pages"
+       : largePages == TRANSPARENT_LARGE_PAGES ? "transparent huge pages"
+                                               : "no huge pages";
+}
+
+
+/// TranspositionTable::stats() scans the whole table, split among threads as
+/// in clear(), and returns a report of the exact occupancy by relative age,
+/// the depth histogram, the bound type distribution and the PV flag ratio.
+/// Unlike hashfull(), which samples the first clusters only, this is meant to
+/// be used to size the hash for long analysis.
+
+template<int ClusterSize, int ClusterBytes>
+std::string BasicTranspositionTable<ClusterSize, ClusterBytes>::stats() const {
+
+  constexpr int AgeCount = 32, DepthOffset = 16, DepthCount = 256;
+
+  struct Counters {
+    uint64_t used, pv;
+    uint64_t age[AgeCount];
+    uint64_t depth[DepthCount];
+    uint64_t bound[4];
+  };
+
+  Threads.main()->wait_for_search_finished();
+
+  const size_t threadCount = Options["Threads"];
+  std::vector<Counters> counters(threadCount, Counters());
+  std::vector<std::thread> threads;
+
+  for (size_t idx = 0; idx < threadCount; ++idx)
+      threads.emplace_back([this, idx, threadCount, &counters]() {
+
+          if (threadCount > 8)
+              WinProcGroup::bindThisThread(idx);
+
+          const size_t stride = clusterCount / threadCount,
+                       start  = stride * idx,
+                       len    = idx != threadCount - 1 ?
+                                stride : clusterCount - start;
+
+          Counters& c = counters[idx];
+
+          for (size_t i = start; i < start + len; ++i)
+              for (const TTEntry& tte : table[i].entry)
+              {
+                  if (tte.empty())
+                      continue;
+
+                  c.used++;
+                  c.pv += tte.is_pv();
+                  c.age[((263 + generation8 - tte.gen_bound()) & 0xF8) / 8]++;
+                  c.depth[std::max(0, std::min(DepthCount - 1, tte.depth_raw() + DepthOffset))]++;
+                  c.bound[tte.bound()]++;
+              }
+      });
+
+  for (std::thread& th: threads)
+      th.join();
+
+  Counters sum = Counters();
+  for (const Counters& c : counters)
+  {
+      sum.used += c.used;
+      sum.pv   += c.pv;
+      for (int i = 0; i < AgeCount; ++i)
+          sum.age[i] += c.age[i];
+      for (int i = 0; i < DepthCount; ++i)
+          sum.depth[i] += c.depth[i];
+      for (int i = 0; i < 4; ++i)
+          sum.bound[i] += c.bound[i];
+  }
+
+  const uint64_t total = uint64_t(clusterCount) * ClusterSize;
+  auto pct = [](uint64_t n, uint64_t d) { return d ? 100.0 * n / d : 0.0; };
+
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(2)
+     << "Hash " << mbCount << " MB, " << clusterCount << " clusters of "
+     << ClusterSize << " entries (" << ClusterBytes << " bytes)\n"
+     << "Pages           : " << pages() << "\n"
+     << "Entries used    : " << sum.used << " of " << total
+     << " (" << pct(sum.used, total) << "%)\n"
+     << "Exact hashfull  : " << (total ? sum.age[0] * 1000 / total : 0) << "\n"
+     << "PV entries      : " << sum.pv << " (" << pct(sum.pv, sum.used) << "% of used)\n"
+     << "Bound none      : " << sum.bound[BOUND_NONE]  << " (" << pct(sum.bound[BOUND_NONE],  sum.used) << "%)\n"
+     << "Bound upper     : " << sum.bound[BOUND_UPPER] << " (" << pct(sum.bound[BOUND_UPPER], sum.used) << "%)\n"
+     << "Bound lower     : " << sum.bound[BOUND_LOWER] << " (" << pct(sum.bound[BOUND_LOWER], sum.used) << "%)\n"
+     << "Bound exact     : " << sum.bound[BOUND_EXACT] << " (" << pct(sum.bound[BOUND_EXACT], sum.used) << "%)\n"
+     << "\nAge (searches ago)   Entries   % of table\n";
+
+  for (int i = 0; i < AgeCount; ++i)
+      if (sum.age[i])
+          ss << std::setw(18) << i << std::setw(10) << sum.age[i]
+             << std::setw(13) << pct(sum.age[i], total) << "\n";
+
+  ss << "\nDepth                Entries   % of used\n";
+
+  for (int i = 0; i < DepthCount; ++i)
+      if (sum.depth[i])
+          ss << std::setw(18) << i - DepthOffset << std::setw(10) << sum.depth[i]
+             << std::setw(13) << pct(sum.depth[i], sum.used) << "\n";
+
+  return ss.str();
+}
+
+// Member functions are defined here, for the geometry selected at compile time
+template class BasicTranspositionTable<TT_CLUSTER_BYTES / sizeof(TTEntry), TT_CLUSTER_BYTES>;
+
 //kellyKinyama mcts begin
-void EXPresize() {
+namespace {
 
-	ifstream myFile("experience.bin", ios::in | ios::binary);
+/// FileStamp identifies a version of a file, to detect when it has changed
+struct FileStamp {
 
+  FileStamp() = default;
+  explicit FileStamp(const char* fname) {
+      struct stat st;
+      if (!stat(fname, &st))
+          size = uint64_t(st.st_size), mtime = st.st_mtime;
+  }
 
-	int load = 1;
-	while (load)
-	{
-		ExpEntry tempExpEntry;
-		tempExpEntry.depth = Depth(0);
-		tempExpEntry.hashkey = 0;
-		tempExpEntry.move = Move(0);
-		tempExpEntry.score = Value(0);
+  bool operator==(const FileStamp& s) const { return size == s.size && mtime == s.mtime; }
 
-		myFile.read((char*)&tempExpEntry, sizeof(tempExpEntry));
+  uint64_t size = 0;
+  time_t mtime = 0;
+};
 
-		if (tempExpEntry.hashkey)
-		{
+FileStamp ExpStamp, JournalStamp; // Of the files as last loaded by EXPresize()
 
-			mctsInsert(tempExpEntry);
-		}
-		else
-			load = 0;
+/// The moves of a position keep the deepest result seen for each of them, and
+/// are ordered by increasing depth, the latest last among equally deep ones,
+/// so that the search finds the deepest result in the last move. settle() moves
+/// the just updated move x back in order, before the end of the moves.
+template<typename T>
+void settle(T* x, T* end) {
 
+  for ( ; x + 1 < end && (x + 1)->depth <= x->depth; ++x)
+      std::swap(*x, *(x + 1));
+}
 
+} // namespace
 
-		if (!tempExpEntry.hashkey)
-			load = 0;
+
+/// EXPresize() maps experience.exp and loads experience.bin in the experience
+/// table. It is called before every search, so it does nothing for the files
+/// unchanged since the previous call. experience.bin is only appended to, so
+/// when it grew only the new records are loaded: loading them all again would
+/// count their visits twice.
+
+void EXPresize() {
+
+	ExpWriter.flush(); // Do not read a record being appended
+
+	FileStamp exp("experience.exp"), journal("experience.bin");
+
+	if (!(exp == ExpStamp))
+	{
+		ExpFile.map("experience.exp");
+		ExpStamp = exp;
 	}
+
+	if (journal == JournalStamp)
+		return;
+
+	// Replaced or truncated, not appended to, so reload it from scratch
+	if (JournalStamp.size && journal.size <= JournalStamp.size)
+	{
+		MCTS.clear();
+		JournalStamp = FileStamp();
+	}
+
+	ifstream myFile("experience.bin", ios::in | ios::binary);
+	myFile.seekg(JournalStamp.size);
+
+	ExpEntry tempExpEntry;
+	while (myFile.read((char*)&tempExpEntry, sizeof(tempExpEntry)) && tempExpEntry.hashkey)
+		mctsInsert(tempExpEntry);
+
 	myFile.close();
 
+	JournalStamp = journal;
 }
 void EXPawnresize() {
 
+	ExpWriter.flush();
+
 	ifstream myFile("pawngame.bin", ios::in | ios::binary);
 
 
@@ -231,6 +640,8 @@ void EXPawnresize() {
 void EXPload(char* fen)
 {
 
+	ExpWriter.flush();
+
 	ifstream myFile(fen, ios::in | ios::binary);
 
 
@@ -260,121 +671,795 @@ void EXPload(char* fen)
 	myFile.close();
 }
 
+/// MCTSHashTable::resize() allocates the table for the given size in megabytes,
+/// dropping all the nodes it holds.
+
+void MCTSHashTable::resize(size_t mbSize) {
+
+  Threads.main()->wait_for_search_finished();
+
+  allocate(mbSize);
+  JournalStamp = FileStamp(); // experience.bin must be loaded again
+}
+
+
+/// MCTSHashTable::allocate() does the actual allocation for resize(). It is
+/// also called by publish() on the first insertion, with the main thread
+/// already searching, so it must not wait for the search to finish.
+
+void MCTSHashTable::allocate(size_t mbSize) {
+
+  large_pages_free(mem, nodeCount * sizeof(NodeInfo), largePages);
+
+  nodeCount = std::max(size_t(1), mbSize) * 1024 * 1024 / sizeof(NodeInfo);
+  mem = large_pages_alloc(nodeCount * sizeof(NodeInfo), largePages);
+
+  if (!mem)
+  {
+      std::cerr << "Failed to allocate " << mbSize
+                << "MB for the experience table." << std::endl;
+      exit(EXIT_FAILURE);
+  }
+
+  table = static_cast<NodeInfo*>(mem);
+  clear();
+}
+
+
+/// MCTSHashTable::clear() empties the table
+
+void MCTSHashTable::clear() {
+
+  if (table)
+      std::memset(table, 0, nodeCount * sizeof(NodeInfo));
+
+  count = 0;
+  full = false;
+}
+
+
+/// MCTSHashTable::find() returns the node of the given position, or nullptr
+/// if the position is not in the table.
+
+Node MCTSHashTable::find(Key key) const {
+
+  if (!table)
+      return nullptr;
+
+  for (size_t i = index(key); table[i].hashkey; i = (i + 1 == nodeCount ? 0 : i + 1))
+      if (table[i].hashkey == key)
+          return &table[i];
+
+  return nullptr;
+}
+
+
+/// MCTSHashTable::find_or_insert() returns the node of the given position,
+/// creating an empty one with no sons if needed. It returns nullptr when the
+/// table is full.
+
+Node MCTSHashTable::find_or_insert(Key key) {
+
+  assert(key);
+
+  if (!table)
+      allocate(Options["Experience Size"]);
+
+  size_t i = index(key);
+  for ( ; table[i].hashkey; i = (i + 1 == nodeCount ? 0 : i + 1))
+      if (table[i].hashkey == key)
+          return &table[i];
+
+  if (count * 100 >= nodeCount * MaxLoadPercent)
+  {
+      if (!full)
+          sync_cout << "info string Experience table full, increase Experience Size" << sync_endl;
+
+      full = true;
+      return nullptr;
+  }
+
+  count++;
+  table[i].hashkey = key;
+  return &table[i];
+}
+
+
+/// MCTSHashTable::insert() queues an entry, to be added to the table by the
+/// next publish(). It can be called at any time, also during a search.
+
+void MCTSHashTable::insert(const ExpEntry& e) {
+
+  std::lock_guard<Mutex> lk(mutex);
+  pending.push_back(e);
+}
+
+
+/// MCTSHashTable::publish() adds the queued entries to the table. It must not
+/// be called while the search threads are probing the table.
+
+void MCTSHashTable::publish() {
+
+  std::lock_guard<Mutex> lk(mutex);
+
+  for (const ExpEntry& e : pending)
+      add(e);
+
+  pending.clear();
+  pending.shrink_to_fit();
+}
+
+
+/// MCTSHashTable::add() merges an entry in the node of its position. A move seen
+/// again keeps its deepest depth and score, ties going to the latest entry.
+
+void MCTSHashTable::add(const ExpEntry& e) {
+
+  Node node = find_or_insert(e.hashkey);
+
+  if (!node)
+      return;
+
+  for (int x = 0; x < node->sons; x++)
+      if (node->child[x].move == e.move)
+      {
+          if (e.depth >= node->child[x].depth)
+          {
+              node->child[x].depth = e.depth;
+              node->child[x].score = e.score;
+          }
+          node->child[x].visits++;
+          node->totalVisits++;
+          settle(&node->child[x], &node->child[node->sons]);
+          return;
+      }
+
+  // New node, or a new move for an existing node
+  if (node->sons < MAX_CHILDREN)
+  {
+      node->child[node->sons].move = e.move;
+      node->child[node->sons].depth = e.depth;
+      node->child[node->sons].score = e.score;
+      node->child[node->sons].visits = 1;
+      node->sons++;
+      node->totalVisits++;
+      settle(&node->child[node->sons - 1], &node->child[node->sons]);
+  }
+}
+
+
 void mctsInsert(ExpEntry tempExpEntry)
 {
-	// If the node already exists in the hash table, we want to return it.
-	// We search in the range of all the hash table entries with key "key1".
-	auto range = MCTS.equal_range(tempExpEntry.hashkey);
-	auto it1 = range.first;
-	auto it2 = range.second;
-
-	bool newNode = true;
-	while (it1 != it2)
-	{
-		Node node = &(it1->second);
+	MCTS.insert(tempExpEntry);
+}
+
+namespace {
 
-		if (node->hashkey == tempExpEntry.hashkey)
+/// rebuild_experience() replaces experience.exp with the file built by the given
+/// function from experience.exp and experience.bin, empties experience.bin and
+/// loads the experience again.
+
+template<typename F>
+void rebuild_experience(F build) {
+
+  Threads.main()->wait_for_search_finished();
+
+  ExpWriter.flush();
+  ExpFile.unmap(); // Windows cannot replace a mapped file
+  ExpStamp = FileStamp();
+
+  if (build())
+  {
+      std::ofstream("experience.bin", std::ios::out | std::ios::binary | std::ios::trunc);
+      MCTS.clear();
+      JournalStamp = FileStamp();
+  }
+
+  EXPresize();
+  sync_cout << "info string Experience file has " << ExpFile.size() << " moves" << sync_endl;
+}
+
+} // namespace
+
+
+/// EXPconvert() folds experience.bin into the sorted experience.exp, then empties
+/// experience.bin and reloads the experience, now served from experience.exp.
+
+void EXPconvert() {
+
+  rebuild_experience([]() {
+      return ExperienceFile::convert("experience.exp", "experience.bin");
+  });
+}
+
+
+/// EXPcompact() is like EXPconvert(), but drops the moves searched below minDepth
+
+void EXPcompact(Depth minDepth) {
+
+  rebuild_experience([minDepth]() {
+
+      std::vector<std::string> inputs;
+      for (const char* f : { "experience.exp", "experience.bin" })
+          if (std::ifstream(f).good())
+              inputs.push_back(f);
+
+      return ExperienceFile::merge(inputs, "experience.exp", minDepth);
+  });
+}
+
+
+/// EXPmerge() merges experience files, e.g. collected on several machines, in
+/// a new sorted experience file.
+
+void EXPmerge(const std::vector<std::string>& inputs, const std::string& out, Depth minDepth) {
+
+  Threads.main()->wait_for_search_finished();
+
+  ExpWriter.flush();
+  ExpFile.unmap(); // In case out is experience.exp, mapped again by the next search
+  ExpStamp = FileStamp();
+
+  ExperienceFile::merge(inputs, out, minDepth);
+}
+
+
+/// get_node() probes the Monte-Carlo hash table and the sorted experience file
+/// to find the node with the given position. It returns nullptr if the position
+/// is in neither. A node read from the file is built in a per-thread buffer,
+/// valid until the next call from the same thread.
+Node get_node(Key key) {
+
+	Node node = MCTS.find(key);
+
+	if (!ExpFile.size())
+		return node;
+
+	static thread_local NodeInfo buffer;
+
+	if (!ExpFile.probe(key, buffer))
+		return node;
+
+	// Entries not yet converted are merged after the ones of the file, as
+	// MCTSHashTable::add() would do.
+	if (node)
+		for (int i = 0; i < node->sons; ++i)
 		{
-			bool newChild = true;
-			newNode = false;
-			for (int x = 0; x < node->sons; x++)
+			int x = 0;
+			while (x < buffer.sons && buffer.child[x].move != node->child[i].move)
+				x++;
+
+			if (x == buffer.sons && buffer.sons == MAX_CHILDREN)
+				continue;
+
+			bool added = x == buffer.sons;
+
+			if (added)
 			{
-				if (node->child[x].move == tempExpEntry.move)
-				{
-					newChild = false;
-					node->child[x].move = tempExpEntry.move;
-					node->child[x].depth = tempExpEntry.depth;
-					node->child[x].score = tempExpEntry.score;
-					node->child[x].visits++;
-					//	node->sons++;
-					node->totalVisits++;
-					break;
-				}
+				buffer.child[x].move = node->child[i].move;
+				buffer.child[x].visits = 0;
+				buffer.sons++;
 			}
-			if (newChild && node->sons < MAX_CHILDREN)
+
+			if (added || node->child[i].depth >= buffer.child[x].depth)
 			{
-				node->child[node->sons].move = tempExpEntry.move;
-				node->child[node->sons].depth = tempExpEntry.depth;
-				node->child[node->sons].score = tempExpEntry.score;
-				node->child[node->sons].visits++;
-				node->sons++;
-				node->totalVisits++;
+				buffer.child[x].depth = node->child[i].depth;
+				buffer.child[x].score = node->child[i].score;
 			}
+			buffer.child[x].visits += node->child[i].visits;
+			buffer.totalVisits += node->child[i].visits;
+			settle(&buffer.child[x], &buffer.child[buffer.sons]);
+		}
 
+	return &buffer;
+}
 
 
-		}
+namespace {
 
-		it1++;
-	}
+/// Sorted experience files start with this header, followed by the records
+struct ExpFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t recordSize;
+  uint64_t count;
+};
 
-	if (newNode)
-	{
-		// Node was not found, so we have to create a new one
-		NodeInfo infos;
-
-		infos.hashkey = 0;        // Zobrist hash of pawns
-		infos.sons = 0;
-
-		infos.totalVisits = 0;// number of visits by the Monte-Carlo algorithm
-		infos.child[0].move = MOVE_NONE;
-		infos.child[0].depth = DEPTH_NONE;
-		infos.child[0].score = VALUE_NONE;
-		infos.child[0].visits = 0;
-		std::memset(infos.child, 0, sizeof(Child) * 20);
-
-		infos.hashkey = tempExpEntry.hashkey;        // Zobrist hash of pawns
-		infos.sons = 1;       // number of visits by the Monte-Carlo algorithm
-		infos.totalVisits = 1;
-		infos.child[0].move = tempExpEntry.move;
-		infos.child[0].depth = tempExpEntry.depth;
-		infos.child[0].score = tempExpEntry.score;
-		infos.child[0].visits = 1;       // number of sons expanded by the Monte-Carlo algorithm
-										 //infos.lastMove = MOVE_NONE; // the move between the parent and this node
-
-										 //debug << "inserting into the hash table: key = " << key1 << endl;
-
-		MCTS.insert(make_pair(tempExpEntry.hashkey, infos));
-	}
+constexpr char ExpFileMagic[8] = { 'S', 'H', 'A', 'S', 'H', 'E', 'X', 'P' };
+constexpr uint32_t ExpFileVersion = 1;
+
+/// replace_file() renames tmpFile to fname, replacing it if it exists
+bool replace_file(const std::string& tmpFile, const std::string& fname) {
+
+  return   !(std::remove(fname.c_str()) && std::ifstream(fname).good())
+        && !std::rename(tmpFile.c_str(), fname.c_str());
 }
 
-/// get_node() probes the Monte-Carlo hash table to find the node with the given
-/// position, creating a new entry if it doesn't exist yet in the table.
-/// The returned node is always valid.
-Node get_node(Key key) {
+/// fold() adds a record to the moves of its position as MCTSHashTable::add()
+/// does, so that a file gives the search the same entries as the table: a move
+/// seen again keeps its deepest depth and score and sums the visits, a new move
+/// is added while the position has less than MAX_CHILDREN moves, and the moves
+/// stay ordered by depth.
+void fold(std::vector<ExpRecord>& moves, const ExpRecord& r) {
 
+  auto m = std::find_if(moves.begin(), moves.end(),
+                        [&](const ExpRecord& x) { return x.move == r.move; });
 
-	// If the node already exists in the hash table, we want to return it.
-	// We search in the range of all the hash table entries with key "key1".
+  if (m != moves.end())
+  {
+      if (r.depth >= m->depth)
+      {
+          m->depth = r.depth;
+          m->score = r.score;
+      }
+      m->visits += r.visits;
+  }
+  else if (moves.size() < MAX_CHILDREN)
+      m = moves.insert(moves.end(), r);
+  else
+      return;
 
-	Node mynode = nullptr;
-	auto range = MCTS.equal_range(key);
-	auto it1 = range.first;
-	auto it2 = range.second;
+  settle(&*m, moves.data() + moves.size());
+}
 
-	if (
-		it1 != MCTS.end()
-		&& 
-		it2 != MCTS.end()
-		)
-	{
+} // namespace
 
-		mynode = &(it1->second);
 
-		while (
-			it1 != it2
-			&&
-			it1 != MCTS.end()
-			)
-		{
-			Node node = &(it1->second);
-			if (node->hashkey == key)
-				return node;
+/// ExperienceFile::map() maps the given sorted experience file read-only in
+/// memory. A missing or invalid file leaves the experience file empty. It must
+/// not be called while the search threads are probing the file.
 
-			it1++;
-		}
+bool ExperienceFile::map(const std::string& fname) {
 
-	}
-	return mynode;
+  unmap();
+
+  ExpFileHeader h;
+  uint64_t size = 0;
+
+#ifndef _WIN32
+
+  int fd = ::open(fname.c_str(), O_RDONLY);
+  struct stat st;
+
+  if (fd == -1)
+      return false;
+
+  if (!fstat(fd, &st) && size_t(st.st_size) >= sizeof(h))
+  {
+      size = st.st_size;
+      baseAddress = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+      if (baseAddress == MAP_FAILED)
+          baseAddress = nullptr;
+      else
+          madvise(baseAddress, size, MADV_RANDOM);
+  }
+
+  ::close(fd);
+  mapping = size;
+
+#else
+
+  HANDLE fd = CreateFile(fname.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                         OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+
+  if (fd == INVALID_HANDLE_VALUE)
+      return false;
+
+  DWORD sizeHigh;
+  DWORD sizeLow = GetFileSize(fd, &sizeHigh);
+  size = (uint64_t(sizeHigh) << 32) | sizeLow;
+
+  if (size >= sizeof(h))
+  {
+      HANDLE mmap = CreateFileMapping(fd, nullptr, PAGE_READONLY, sizeHigh, sizeLow, nullptr);
+
+      if (mmap)
+      {
+          mapping = (uint64_t)mmap;
+          baseAddress = MapViewOfFile(mmap, FILE_MAP_READ, 0, 0, 0);
+      }
+  }
+
+  CloseHandle(fd);
+
+#endif
+
+  if (!baseAddress)
+  {
+      unmap();
+      return false;
+  }
+
+  std::memcpy(&h, baseAddress, sizeof(h));
+
+  if (   std::memcmp(h.magic, ExpFileMagic, sizeof(h.magic))
+      || h.version != ExpFileVersion
+      || h.recordSize != sizeof(ExpRecord)
+      || h.count != (size - sizeof(h)) / sizeof(ExpRecord))
+  {
+      sync_cout << "info string " << fname << " is not a valid experience file" << sync_endl;
+      unmap();
+      return false;
+  }
+
+  records = (const ExpRecord*)((const char*)baseAddress + sizeof(h));
+  count = h.count;
+  return true;
+}
+
+
+/// ExperienceFile::unmap() releases the mapped file, if any
+
+void ExperienceFile::unmap() {
+
+#ifndef _WIN32
+  if (baseAddress)
+      munmap(baseAddress, mapping);
+#else
+  if (baseAddress)
+      UnmapViewOfFile(baseAddress);
+  if (mapping)
+      CloseHandle((HANDLE)mapping);
+#endif
+
+  baseAddress = nullptr;
+  mapping = 0;
+  records = nullptr;
+  count = 0;
+}
+
+
+/// ExperienceFile::probe() fills the node of the given position from the file
+/// and returns true, or returns false if the position is not in the file. Keys
+/// are uniformly distributed, so a few interpolation steps narrow the range to
+/// a handful of records before the final bisection.
+
+bool ExperienceFile::probe(Key key, NodeInfo& node) const {
+
+  const ExpRecord* first = records;
+  const ExpRecord* last = records + count;
+
+  for (int i = 0; i < 4 && last - first > 16; ++i)
+  {
+      Key lo = first->hashkey, hi = (last - 1)->hashkey;
+
+      if (key <= lo || key > hi)
+          break;
+
+      const ExpRecord* p = first + size_t(double(key - lo) / double(hi - lo) * (last - first - 1));
+
+      if (p->hashkey < key)
+          first = p + 1;
+      else
+          last = p + 1;
+  }
+
+  const ExpRecord* r = std::lower_bound(first, last, key,
+                       [](const ExpRecord& e, Key k) { return e.hashkey < k; });
+
+  if (r == records + count || r->hashkey != key)
+      return false;
+
+  node.hashkey = key;
+  node.sons = node.totalVisits = 0;
+
+  for ( ; r < records + count && r->hashkey == key && node.sons < MAX_CHILDREN; ++r)
+  {
+      Child& c = node.child[node.sons++];
+      c.move   = Move(r->move);
+      c.depth  = Depth(r->depth);
+      c.score  = Value(r->score);
+      c.visits = r->visits;
+      node.totalVisits += r->visits;
+  }
+
+  return true;
+}
+
+
+/// ExperienceFile::convert() builds a sorted experience file from the records
+/// already in it, if any, followed by the ones of the given append-only file.
+/// Records of the same position are folded in insertion order by fold().
+
+bool ExperienceFile::convert(const std::string& sortedFile, const std::string& appendFile) {
+
+  std::vector<ExpRecord> recs;
+  ExpFileHeader h;
+  std::ifstream in(sortedFile, std::ios::in | std::ios::binary);
+
+  if (   in.read((char*)&h, sizeof(h))
+      && !std::memcmp(h.magic, ExpFileMagic, sizeof(h.magic))
+      && h.version == ExpFileVersion
+      && h.recordSize == sizeof(ExpRecord))
+  {
+      recs.resize(size_t(h.count));
+      in.read((char*)recs.data(), recs.size() * sizeof(ExpRecord));
+      recs.resize(size_t(in.gcount()) / sizeof(ExpRecord));
+  }
+  in.close();
+
+  std::ifstream app(appendFile, std::ios::in | std::ios::binary);
+  ExpEntry e;
+
+  while (app.read((char*)&e, sizeof(e)) && e.hashkey)
+      recs.push_back({ e.hashkey, int32_t(e.move), int32_t(e.depth), int32_t(e.score), 1 });
+
+  // A stable sort keeps the records of each position in insertion order
+  std::stable_sort(recs.begin(), recs.end(),
+                   [](const ExpRecord& a, const ExpRecord& b) { return a.hashkey < b.hashkey; });
+
+  // Fold in place, the moves of a position never outnumbering its records
+  std::vector<ExpRecord> moves;
+  size_t out = 0;
+
+  for (size_t i = 0; i < recs.size(); ++i)
+  {
+      fold(moves, recs[i]);
+
+      if (i + 1 == recs.size() || recs[i + 1].hashkey != recs[i].hashkey)
+      {
+          std::copy(moves.begin(), moves.end(), recs.begin() + out);
+          out += moves.size();
+          moves.clear();
+      }
+  }
+  recs.resize(out);
+
+  const std::string tmpFile = sortedFile + ".tmp";
+  std::ofstream file(tmpFile, std::ios::out | std::ios::binary | std::ios::trunc);
+
+  std::memcpy(h.magic, ExpFileMagic, sizeof(h.magic));
+  h.version = ExpFileVersion;
+  h.recordSize = sizeof(ExpRecord);
+  h.count = recs.size();
+
+  file.write((const char*)&h, sizeof(h));
+  file.write((const char*)recs.data(), recs.size() * sizeof(ExpRecord));
+  file.close();
+
+  if (!file || !replace_file(tmpFile, sortedFile))
+  {
+      sync_cout << "info string Could not write " << sortedFile << sync_endl;
+      return false;
+  }
+
+  return true;
+}
+
+
+/// ExperienceFile::merge() folds the given experience files, sorted or append-only,
+/// in a new sorted file. It works on files larger than memory, as an external
+/// sort: the append-only files are split in sorted runs written to temporary
+/// files, then all the runs are merged in a single pass. Records of the same
+/// position are folded by fold() in the order of the input files, as convert()
+/// does, then the moves searched below minDepth are dropped.
+
+bool ExperienceFile::merge(const std::vector<std::string>& inputs, const std::string& out, Depth minDepth) {
+
+  constexpr size_t RunRecords = 4 * 1024 * 1024; // 96 MB of records per run
+
+  std::vector<std::string> runFiles, tmpFiles;
+  ExpFileHeader h;
+  bool ok = true;
+
+  // Sorted files are runs already, append-only ones are cut in sorted runs
+  for (const std::string& fname : inputs)
+  {
+      std::ifstream in(fname, std::ios::in | std::ios::binary);
+
+      if (!in)
+      {
+          sync_cout << "info string Could not open " << fname << sync_endl;
+          ok = false;
+          break;
+      }
+
+      if (   in.read((char*)&h, sizeof(h))
+          && !std::memcmp(h.magic, ExpFileMagic, sizeof(h.magic)))
+      {
+          if (h.version != ExpFileVersion || h.recordSize != sizeof(ExpRecord))
+          {
+              sync_cout << "info string " << fname << " is not a valid experience file" << sync_endl;
+              ok = false;
+              break;
+          }
+
+          runFiles.push_back(fname);
+          continue;
+      }
+
+      in.clear();
+      in.seekg(0);
+
+      std::vector<ExpRecord> run;
+      ExpEntry e;
+
+      while (ok && in)
+      {
+          run.clear();
+
+          while (run.size() < RunRecords && in.read((char*)&e, sizeof(e)))
+              if (e.hashkey)
+                  run.push_back({ e.hashkey, int32_t(e.move), int32_t(e.depth), int32_t(e.score), 1 });
+
+          if (run.empty())
+              break;
+
+          std::stable_sort(run.begin(), run.end(),
+                           [](const ExpRecord& a, const ExpRecord& b) { return a.hashkey < b.hashkey; });
+
+          const std::string runFile = out + ".run" + std::to_string(tmpFiles.size());
+          std::ofstream rf(runFile, std::ios::out | std::ios::binary | std::ios::trunc);
+          rf.write((const char*)run.data(), run.size() * sizeof(ExpRecord));
+          rf.close();
+
+          tmpFiles.push_back(runFile);
+          runFiles.push_back(runFile);
+          ok = bool(rf);
+      }
+  }
+
+  const std::string tmpFile = out + ".tmp";
+  uint64_t count = 0;
+
+  if (ok)
+  {
+      // Merge the runs, popping the records by key, then by run, so that the
+      // records of a position keep the order of the input files.
+      std::vector<std::ifstream> runs(runFiles.size());
+      std::vector<ExpRecord> heads(runFiles.size());
+      std::priority_queue<std::pair<Key, size_t>, std::vector<std::pair<Key, size_t>>,
+                          std::greater<std::pair<Key, size_t>>> pq;
+
+      auto next = [&](size_t i) {
+          if (runs[i].read((char*)&heads[i], sizeof(ExpRecord)))
+              pq.emplace(heads[i].hashkey, i);
+      };
+
+      for (size_t i = 0; i < runFiles.size(); ++i)
+      {
+          runs[i].open(runFiles[i], std::ios::in | std::ios::binary);
+
+          if (std::find(tmpFiles.begin(), tmpFiles.end(), runFiles[i]) == tmpFiles.end())
+              runs[i].seekg(sizeof(ExpFileHeader));
+
+          next(i);
+      }
+
+      std::ofstream file(tmpFile, std::ios::out | std::ios::binary | std::ios::trunc);
+      file.write((const char*)&h, sizeof(h)); // Written again at the end, with the count
+
+      std::vector<ExpRecord> moves;
+
+      while (!pq.empty())
+      {
+          const Key key = pq.top().first;
+          moves.clear();
+
+          while (!pq.empty() && pq.top().first == key)
+          {
+              size_t i = pq.top().second;
+              const ExpRecord& r = heads[i];
+              pq.pop();
+
+              fold(moves, r);
+              next(i);
+          }
+
+          moves.erase(std::remove_if(moves.begin(), moves.end(),
+                                     [&](const ExpRecord& x) { return x.depth < minDepth; }),
+                      moves.end());
+
+          file.write((const char*)moves.data(), moves.size() * sizeof(ExpRecord));
+          count += moves.size();
+      }
+
+      std::memcpy(h.magic, ExpFileMagic, sizeof(h.magic));
+      h.version = ExpFileVersion;
+      h.recordSize = sizeof(ExpRecord);
+      h.count = count;
+
+      file.seekp(0);
+      file.write((const char*)&h, sizeof(h));
+      file.close();
+
+      for (std::ifstream& r : runs)
+          r.close();
+
+      ok = file && replace_file(tmpFile, out);
+
+      if (!ok)
+          sync_cout << "info string Could not write " << out << sync_endl;
+  }
+
+  for (const std::string& f : tmpFiles)
+      std::remove(f.c_str());
+
+  if (ok)
+      sync_cout << "info string Merged " << count << " moves in " << out << sync_endl;
+
+  return ok;
+}
+
+
+/// ExperienceWriter::write() queues a record to be appended to the given file
+
+void ExperienceWriter::write(const std::string& fname, const ExpEntry& e) {
+
+  std::lock_guard<Mutex> lk(mutex);
+
+  if (!thread.joinable())
+      thread = std::thread(&ExperienceWriter::idle_loop, this);
+
+  queue.emplace_back(fname, e);
+  cv.notify_all();
+}
+
+
+/// ExperienceWriter::flush() blocks until all the queued records are written
+
+void ExperienceWriter::flush() {
+
+  std::unique_lock<Mutex> lk(mutex);
+  cv.wait(lk, [&]{ return queue.empty() && !writing; });
+}
+
+
+/// ExperienceWriter::~ExperienceWriter() writes what is still queued and stops
+/// the thread.
+
+ExperienceWriter::~ExperienceWriter() {
+
+  {
+      std::lock_guard<Mutex> lk(mutex);
+      exit = true;
+  }
+
+  cv.notify_all();
+
+  if (thread.joinable())
+      thread.join();
+}
+
+
+/// ExperienceWriter::idle_loop() is where the writer thread waits for records
+/// and appends them to their files.
+
+void ExperienceWriter::idle_loop() {
+
+  while (true)
+  {
+      std::unique_lock<Mutex> lk(mutex);
+      cv.wait(lk, [&]{ return exit || !queue.empty(); });
+
+      if (queue.empty())
+          return;
+
+      std::vector<std::pair<std::string, ExpEntry>> batch;
+      batch.swap(queue);
+      writing = true;
+      lk.unlock();
+
+      // Group the records by file, keeping their order within a file
+      std::stable_sort(batch.begin(), batch.end(),
+                       [](const std::pair<std::string, ExpEntry>& a,
+                          const std::pair<std::string, ExpEntry>& b) { return a.first < b.first; });
+
+      for (size_t i = 0; i < batch.size(); )
+      {
+          std::ofstream file(batch[i].first, std::ios::out | std::ios::app | std::ios::binary);
+          size_t j = i;
+
+          for ( ; j < batch.size() && batch[j].first == batch[i].first; ++j)
+              file.write((const char*)&batch[j].second, sizeof(ExpEntry));
+
+          i = j;
+      }
+
+      lk.lock();
+      writing = false;
+      cv.notify_all();
+  }
 }
 //kellyKinyama mcts end
@@ -21,9 +21,17 @@
 #ifndef TT_H_INCLUDED
 #define TT_H_INCLUDED
 
+#include <atomic>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
 #include "misc.h"
+#include "thread_win32_osx.h"
 #include "types.h"
-#include <unordered_map> //frol Kellykynyama
+
+#ifndef USE_TT_XOR
 
 /// TTEntry struct is the 10 bytes transposition table entry, defined as below:
 ///
@@ -47,7 +55,13 @@ struct TTEntry {
   void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev);
 
 private:
-  friend class TranspositionTable;
+  template<int, int> friend class BasicTranspositionTable;
+
+  bool empty() const { return !key16; }
+  bool matches(Key k) const { return key16 == (k >> 48); }
+  uint8_t gen_bound() const { return genBound8; }
+  int8_t depth_raw() const { return depth8; }
+  void refresh(const TTEntry& e, uint8_t gen) { genBound8 = uint8_t(gen | (e.genBound8 & 0x7)); }
 
   uint16_t key16;
   uint16_t move16;
@@ -57,6 +71,49 @@ private:
   int8_t   depth8;
 };
 
+#else
+
+/// With USE_TT_XOR the TTEntry is 16 bytes: a data word packing the same fields
+/// as the default entry, and a check word holding the full 64 bit position key
+/// XORed with the data word:
+///
+/// check      64 bit  (key ^ data)
+/// data       64 bit  move 16 | value 16 | eval value 16 | genBound 8 | depth 8
+///
+/// A reader accepts an entry only if check ^ data gives back its key, so a 16 bit
+/// key collision, or an entry torn by a concurrent save() from another thread,
+/// is detected at probe() time instead of returning a move of another position.
+/// probe() verifies a copy of the two words and the search reads that copy, so
+/// that a save() landing after the check cannot mix fields of two positions.
+
+struct TTEntry {
+
+  Move  move()  const { return (Move )uint16_t(data >> 48); }
+  Value value() const { return (Value)int16_t(data >> 32); }
+  Value eval()  const { return (Value)int16_t(data >> 16); }
+  Depth depth() const { return (Depth)(depth_raw() * int(ONE_PLY)); }
+  bool is_pv() const { return (bool)(gen_bound() & 0x4); }
+  Bound bound() const { return (Bound)(gen_bound() & 0x3); }
+  void save(Key k, Value v, bool pv, Bound b, Depth d, Move m, Value ev);
+
+private:
+  template<int, int> friend class BasicTranspositionTable;
+
+  Key key() const { return check ^ data; }
+  bool empty() const { return !key(); }
+  bool matches(Key k) const { return key() == k; }
+  uint8_t gen_bound() const { return uint8_t(data >> 8); }
+  int8_t depth_raw() const { return int8_t(data); }
+  void refresh(const TTEntry& e, uint8_t gen) {
+    store(e.key(), (e.data & ~uint64_t(0xF800)) | uint64_t(gen) << 8);
+  }
+  void store(Key k, uint64_t d) { data = d; check = k ^ d; }
+
+  uint64_t check;
+  uint64_t data;
+};
+
+#endif
 
 /// A TranspositionTable consists of a power of 2 number of clusters and each
 /// cluster consists of ClusterSize number of TTEntry. Each non-empty entry
@@ -64,26 +121,37 @@ private:
 /// divide the size of a cache line size, to ensure that clusters never cross
 /// cache lines. This ensures best cache performance, as the cacheline is
 /// prefetched, as soon as possible.
+///
+/// The cluster geometry is a template parameter: ClusterSize entries padded up
+/// to ClusterBytes. A 64 bytes cluster fills a whole cache line, so a probe
+/// looks at twice the entries for the same single memory access.
 
-class TranspositionTable {
+template<int ClusterSize, int ClusterBytes>
+class BasicTranspositionTable {
 
   static constexpr int CacheLineSize = 64;
-  static constexpr int ClusterSize = 3;
 
-  struct Cluster {
-    TTEntry entry[ClusterSize];
-    char padding[2]; // Align to a divisor of the cache line size
+  struct alignas(ClusterBytes) Cluster {
+    TTEntry entry[ClusterSize]; // Padded by alignas to a divisor of the cache line size
   };
 
+  static_assert(sizeof(Cluster) == ClusterBytes, "Cluster size incorrect");
   static_assert(CacheLineSize % sizeof(Cluster) == 0, "Cluster size incorrect");
 
 public:
- ~TranspositionTable() { free(mem); }
+ ~BasicTranspositionTable() { large_pages_free(mem, clusterCount * sizeof(Cluster), largePages); }
   void new_search() { generation8 += 8; } // Lower 3 bits are used by PV flag and Bound
-  TTEntry* probe(const Key key, bool& found) const;
+  TTEntry probe(const Key key, bool& found, TTEntry*& writer) const;
   int hashfull() const;
+  std::string stats() const;
+  std::string info() const;
   void resize(size_t mbSize);
   void clear();
+  bool save(const std::string& fname) const;
+  bool load(const std::string& fname);
+#ifdef USE_TT_XOR
+  uint64_t key_collisions() const { return keyCollisions.load(std::memory_order_relaxed); }
+#endif
 
   // The 32 lowest order bits of the key are used to get the index of the cluster
   TTEntry* first_entry(const Key key) const {
@@ -92,13 +160,32 @@ public:
 
 private:
   friend struct TTEntry;
+  const char* pages() const;
 
-  size_t clusterCount;
+  size_t clusterCount, mbCount;
   Cluster* table;
   void* mem;
+  LargePages largePages;
   uint8_t generation8; // Size must be not bigger than TTEntry::genBound8
+#ifdef USE_TT_XOR
+  mutable std::atomic<uint64_t> keyCollisions;
+#endif
 };
 
+/// The geometry used by the engine is chosen at compile time with
+/// -DTT_CLUSTER_BYTES=32|64. By default the 10 bytes entries are packed three
+/// in 32 bytes and the XOR verified 16 bytes entries four in 64 bytes.
+
+#ifndef TT_CLUSTER_BYTES
+#  ifndef USE_TT_XOR
+#    define TT_CLUSTER_BYTES 32
+#  else
+#    define TT_CLUSTER_BYTES 64
+#  endif
+#endif
+
+typedef BasicTranspositionTable<TT_CLUSTER_BYTES / sizeof(TTEntry), TT_CLUSTER_BYTES> TranspositionTable;
+
 //mcts kellykynyama begin
 struct ExpEntry
 {
@@ -120,9 +207,12 @@ void EXPresize();
 void EXPawnresize();
 void startposition();
 void EXPload(char* fen);
+void EXPconvert();
+void EXPcompact(Depth minDepth);
+void EXPmerge(const std::vector<std::string>& inputs, const std::string& out, Depth minDepth);
 void mctsInsert(ExpEntry tempExpEntry);
 
-const int MAX_CHILDREN = 25;
+const int MAX_CHILDREN = 20;
 
 struct Child
 {
@@ -132,20 +222,128 @@ struct Child
 	int visits;
 };
 
-struct NodeInfo
+/// NodeInfo is cache line aligned, so that probing a node touches at most its
+/// first cache line for the key and a second one for the child actually used.
+
+struct alignas(64) NodeInfo
 {
 	Key hashkey;
-	Child child[20];
+	Child child[MAX_CHILDREN];
 	int sons;
 	int totalVisits;
 };
 
 typedef NodeInfo* Node;
 Node get_node(Key key);
-// The Monte-Carlo tree is stored implicitly in one big hash table
-typedef std::unordered_multimap<Key, NodeInfo> MCTSHashTable;
+
+/// The Monte-Carlo tree is stored implicitly in one big hash table. It is a
+/// fixed capacity, open addressing table keyed by the full 64 bit position key,
+/// with linear probing on collisions, so that get_node() costs one or two cache
+/// misses instead of walking a chain of heap allocated buckets. An empty node
+/// has a zero key. The memory, sized by the "Experience Size" option, is only
+/// allocated at the first insertion.
+///
+/// The table is read-only while searching, so that all the search threads can
+/// probe it without locking. New entries are queued by insert() and added to
+/// the table by publish(), called by the main thread before the helper threads
+/// start searching.
+
+class MCTSHashTable {
+
+  static constexpr int MaxLoadPercent = 90; // Keeps linear probing chains short
+
+public:
+ ~MCTSHashTable() { large_pages_free(mem, nodeCount * sizeof(NodeInfo), largePages); }
+  void resize(size_t mbSize);
+  void clear();
+  void insert(const ExpEntry& e);
+  void publish();
+  Node find(Key key) const;
+  size_t size() const { return count; }
+
+private:
+  void allocate(size_t mbSize);
+  Node find_or_insert(Key key);
+  void add(const ExpEntry& e);
+  size_t index(Key key) const { return (uint32_t(key) * uint64_t(nodeCount)) >> 32; }
+
+  size_t nodeCount = 0, count = 0;
+  bool full = false;
+  NodeInfo* table = nullptr;
+  void* mem = nullptr;
+  LargePages largePages = NO_LARGE_PAGES;
+  Mutex mutex;
+  std::vector<ExpEntry> pending;
+};
 
 extern MCTSHashTable MCTS;
+
+/// ExpRecord is a (position, move) pair of a sorted experience file. The records
+/// of a position are contiguous and stored in the order of its children.
+
+struct ExpRecord
+{
+	Key hashkey;
+	int32_t move;
+	int32_t depth;
+	int32_t score;
+	int32_t visits;
+};
+
+static_assert(sizeof(ExpRecord) == 24, "Sorted experience files must be portable");
+
+/// ExperienceFile is a compacted experience file: a versioned header followed by
+/// the records sorted by key. It is mapped read-only in memory and probed in
+/// place with an interpolation search, so it costs neither load time nor memory
+/// beyond the pages actually touched. convert() builds it from the append-only
+/// files written during play, merge() combines any number of experience files
+/// of either format, even larger than memory.
+
+class ExperienceFile {
+
+public:
+ ~ExperienceFile() { unmap(); }
+  bool map(const std::string& fname);
+  void unmap();
+  bool probe(Key key, NodeInfo& node) const;
+  size_t size() const { return count; }
+
+  static bool convert(const std::string& sortedFile, const std::string& appendFile);
+  static bool merge(const std::vector<std::string>& inputs, const std::string& out, Depth minDepth);
+
+private:
+  const ExpRecord* records = nullptr;
+  size_t count = 0;
+  void* baseAddress = nullptr;
+  uint64_t mapping = 0;
+};
+
+extern ExperienceFile ExpFile;
+
+/// ExperienceWriter appends the experience learnt during play to the files in
+/// a background thread, started at the first write. The search only queues the
+/// records, so that bestmove is not delayed by the file system. The queue is
+/// written in batches, opening each file once per batch, and it is flushed at
+/// exit by the destructor.
+
+class ExperienceWriter {
+
+public:
+ ~ExperienceWriter();
+  void write(const std::string& fname, const ExpEntry& e);
+  void flush();
+
+private:
+  void idle_loop();
+
+  Mutex mutex;
+  ConditionVariable cv;
+  std::vector<std::pair<std::string, ExpEntry>> queue;
+  std::thread thread;
+  bool exit = false, writing = false;
+};
+
+extern ExperienceWriter ExpWriter;
 //mcts kellykynyama end
 
 extern TranspositionTable TT;
@@ -37,6 +37,12 @@
 ///
 /// -DUSE_PEXT    | Add runtime support for use of pext asm-instruction. Works
 ///               | only in 64-bit mode and requires hardware with pext support.
+///
+/// -DUSE_TT_XOR  | Store transposition table entries as XOR verified 64-bit
+///               | words, to detect key collisions and torn concurrent writes.
+///
+/// -DTT_CLUSTER_BYTES=N | Size of a transposition table cluster, 32 or 64 bytes.
+///               | A 64 bytes cluster holds 6 entries (4 with USE_TT_XOR).
 
 #include <cassert>
 #include <cctype>
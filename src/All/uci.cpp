@@ -19,12 +19,16 @@
 */
 
 #include <cassert>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "evaluate.h"
 #include "movegen.h"
+#include "perceptron.h"
 #include "position.h"
 #include "search.h"
 #include "thread.h"
@@ -248,6 +252,283 @@ namespace {
          << "\nNodes/second    : " << 1000 * nodes / elapsed << endl;
   }
 
+
+  // smp_bench() is called when engine receives the "smpbench" command. It
+  // searches the bench positions to a fixed depth with 1, 2, 4... threads up to
+  // the given number, clearing the hash before each position, and prints the
+  // time to depth of each number of threads and its speedup over one thread.
+
+  void smp_bench(Position& pos, istream& args, StateListPtr& states) {
+
+    string token;
+    size_t maxThreads = (args >> token) ? stoi(token) : std::max(1U, std::thread::hardware_concurrency());
+    string depth      = (args >> token) ? token : "13";
+    string ttSize     = (args >> token) ? token : "16";
+    string fenFile    = (args >> token) ? token : "default";
+
+    string threads = std::to_string(int(Options["Threads"]));
+    string hash    = std::to_string(int(Options["Hash"]));
+    vector<size_t> counts;
+    vector<TimePoint> times;
+    vector<uint64_t> nodes;
+
+    for (size_t t = 1; t < maxThreads; t *= 2)
+        counts.push_back(t);
+    counts.push_back(maxThreads);
+
+    for (size_t t : counts)
+    {
+        istringstream is(ttSize + " " + std::to_string(t) + " " + depth + " " + fenFile + " depth");
+        TimePoint elapsed = 0;
+        uint64_t cnt = 0;
+
+        for (const auto& cmd : setup_bench(pos, is))
+        {
+            istringstream cs(cmd);
+            cs >> skipws >> token;
+
+            if (token == "go")
+            {
+                TimePoint start = now();
+                go(pos, cs, states);
+                Threads.main()->wait_for_search_finished();
+                elapsed += now() - start;
+                cnt += Threads.nodes_searched();
+            }
+            else if (token == "setoption")  setoption(cs);
+            else if (token == "position")
+            {
+                Search::clear(); // Time to depth is measured from an empty hash
+                position(pos, cs, states);
+            }
+        }
+
+        times.push_back(elapsed + 1);
+        nodes.push_back(cnt);
+    }
+
+    Options["Threads"] = threads;
+    Options["Hash"] = hash;
+
+    cerr << "\n==========================="
+         << "\nThreads   Time (ms)   Nodes/second   Speedup";
+
+    for (size_t i = 0; i < counts.size(); ++i)
+        cerr << "\n" << setw(7) << counts[i]
+             << setw(12) << times[i]
+             << setw(15) << 1000 * nodes[i] / times[i]
+             << setw(10) << fixed << setprecision(2) << double(times[0]) / times[i];
+
+    cerr << endl;
+  }
+
+
+  // hash_bench() is called when engine receives the "hashbench" command. It
+  // searches the bench positions to a fixed depth with the pawn and material
+  // hash tables of each thread set to 8 KB, 16 KB... up to 16 MB, and prints the
+  // hit rate of each table and the speed for every size.
+
+  void hash_bench(Position& pos, istream& args, StateListPtr& states) {
+
+    string token;
+    string threads = (args >> token) ? token : "1";
+    string depth   = (args >> token) ? token : "12";
+    string fenFile = (args >> token) ? token : "default";
+
+    string pawnHash     = std::to_string(int(Options["Pawn Hash"]));
+    string materialHash = std::to_string(int(Options["Material Hash"]));
+
+    cerr << "\n==========================="
+         << "\nSize (KB)   Pawn entries   Hit rate (%)   Material entries   Hit rate (%)   Nodes/second";
+
+    for (int kb = 8; kb <= 16384; kb *= 2)
+    {
+        Options["Pawn Hash"] = std::to_string(kb);
+        Options["Material Hash"] = std::to_string(kb);
+
+        istringstream is("16 " + threads + " " + depth + " " + fenFile + " depth");
+        TimePoint elapsed = 0;
+        uint64_t cnt = 0;
+
+        for (const auto& cmd : setup_bench(pos, is))
+        {
+            istringstream cs(cmd);
+            cs >> skipws >> token;
+
+            if (token == "go")
+            {
+                TimePoint start = now();
+                go(pos, cs, states);
+                Threads.main()->wait_for_search_finished();
+                elapsed += now() - start;
+                cnt += Threads.nodes_searched();
+            }
+            else if (token == "setoption")  setoption(cs);
+            else if (token == "position")   position(pos, cs, states);
+            else if (token == "ucinewgame") Search::clear();
+        }
+
+        uint64_t pawnProbes = 0, pawnHits = 0, materialProbes = 0, materialHits = 0;
+        for (Thread* th : Threads)
+        {
+            pawnProbes     += th->pawnsTable.probes,    pawnHits     += th->pawnsTable.hits;
+            materialProbes += th->materialTable.probes, materialHits += th->materialTable.hits;
+        }
+
+        cerr << "\n" << setw(9) << kb
+             << setw(15) << Threads.main()->pawnsTable.size()
+             << setw(15) << fixed << setprecision(2) << 100.0 * pawnHits / std::max(pawnProbes, uint64_t(1))
+             << setw(19) << Threads.main()->materialTable.size()
+             << setw(15) << 100.0 * materialHits / std::max(materialProbes, uint64_t(1))
+             << setw(15) << 1000 * cnt / (elapsed + 1);
+    }
+
+    Options["Pawn Hash"] = pawnHash;
+    Options["Material Hash"] = materialHash;
+
+    cerr << endl;
+  }
+
+
+  // eval_check() is called when engine receives the "evalcheck" command. It
+  // checks the staged evaluation against the full one on the bench positions,
+  // or those of a FEN or EPD file, and on the positions after their legal moves.
+  // For windows all around the full evaluation, the staged one must be the same
+  // when inside the window, and fail on the same side otherwise. A bound beyond
+  // the full evaluation means a margin of the stages is too small. Every set of
+  // features is checked, each with the three sets of Shashin weights.
+
+  void eval_check(Position& pos, istream& args, StateListPtr& states) {
+
+    string token;
+    string fenFile = (args >> token) ? token : "default";
+    istringstream is("16 1 1 " + fenFile + " depth");
+    vector<string> list = setup_bench(pos, is);
+
+    Thread* th = Threads.main();
+    th->wait_for_search_finished(); // The search sets the evaluation state
+    uint8_t shashinValue = th->shashinValue;
+    th->evalCache.resize(0); // Every position must be evaluated again
+
+    uint64_t positions, windows, cuts, looseBounds, errors;
+
+    auto check = [&](const Position& p) {
+
+        if (p.checkers())
+            return;
+
+        Value v = Eval::evaluate(p);
+        positions++;
+
+        for (int center : { -1200, -800, -600, -400, -200, -100, -50, 0, 50, 100, 200, 400, 600, 800, 1200 })
+            for (int width : { 1, 30, 150 })
+            {
+                Value alpha = v + center - width, beta = v + center + width;
+                Value s = Eval::evaluate(p, alpha, beta);
+
+                windows++;
+                cuts += s != v;
+                looseBounds += (v >= beta && s > v) || (v <= alpha && s < v);
+                errors += alpha < v && v < beta ? s != v : v >= beta ? s < beta : s > alpha;
+            }
+    };
+
+    cerr << "\n==========================="
+         << "\nFeatures   Positions     Windows   Lazy cuts   Loose bounds   Errors";
+
+    for (int features = 0; features <= Eval::ALL_FEATURES; ++features)
+    {
+        Eval::set_features(features);
+        positions = windows = cuts = looseBounds = errors = 0;
+
+        for (uint8_t sv : { SHASHIN_POSITION_DEFAULT, SHASHIN_POSITION_PETROSIAN, SHASHIN_POSITION_CAPABLANCA_PETROSIAN })
+        {
+            th->shashinValue = sv; // Selects the weights of the evaluation terms
+
+            for (const auto& cmd : list)
+            {
+                istringstream cs(cmd);
+                cs >> skipws >> token;
+
+                if (token != "position")
+                    continue;
+
+                position(pos, cs, states);
+                check(pos);
+
+                for (const auto& m : MoveList<LEGAL>(pos))
+                {
+                    StateInfo st;
+                    pos.do_move(m, st);
+                    check(pos);
+                    pos.undo_move(m);
+                }
+            }
+        }
+
+        cerr << "\n" << setw(8) << features
+             << setw(12) << positions
+             << setw(12) << windows
+             << setw(12) << cuts
+             << setw(15) << looseBounds
+             << setw(9)  << errors;
+    }
+
+    th->shashinValue = shashinValue;
+    th->resizeTables = true; // The main thread restores its cache before searching
+
+    cerr << endl;
+  }
+
+
+  // train_perceptron() is called when engine receives the "perceptron train"
+  // command. It searches every position of an EPD or FEN file to the given
+  // depth with the perceptron on, so that it learns without playing games, and
+  // saves the weights. Every search uses all the threads, each one training its
+  // own copy of the weights, averaged after each position.
+
+  void train_perceptron(Position& pos, istream& args, StateListPtr& states) {
+
+    string token;
+    string fenFile = (args >> token) ? token : "";
+    string depth   = (args >> token) ? token : "10";
+
+    ifstream file(fenFile);
+
+    if (!file.is_open())
+    {
+        sync_cout << "info string Unable to open file " << fenFile << sync_endl;
+        return;
+    }
+
+    string perceptronSearch = Options["NN Perceptron Search"] ? "true" : "false";
+    Options["NN Perceptron Search"] = string("true");
+
+    string fen;
+    int cnt = 0;
+    TimePoint elapsed = now();
+
+    while (getline(file, fen))
+    {
+        if (fen.empty())
+            continue;
+
+        istringstream position_(fen.find("fen ") == 0 ? fen : "fen " + fen), go_("depth " + depth);
+        position(pos, position_, states);
+        go(pos, go_, states);
+        Threads.main()->wait_for_search_finished();
+        cnt++;
+    }
+
+    elapsed = now() - elapsed + 1;
+
+    Search::SharedPerceptron.save(Search::PerceptronFile);
+    Options["NN Perceptron Search"] = perceptronSearch;
+
+    sync_cout << "info string Perceptron trained on " << cnt << " positions in "
+              << elapsed / 1000 << " s, saved to " << Search::PerceptronFile << sync_endl;
+  }
+
 } // namespace
 
 
@@ -263,6 +544,7 @@ void UCI::loop(int argc, char* argv[]) {
   string token, cmd;
   StateListPtr states(new std::deque<StateInfo>(1));
   auto uiThread = std::make_shared<Thread>(0);
+  bool hashReported = false; // The table allocated at startup, before 'uci'
 
   pos.set(StartFEN, false, &states->back(), uiThread.get());
 
@@ -278,16 +560,24 @@ void UCI::loop(int argc, char* argv[]) {
       token.clear(); // Avoid a stale if getline() returns empty or blank line
       is >> skipws >> token;
 
+      // Report the hash allocated at startup once the GUI listens, the changes
+      // of the Hash option being reported by on_hash_size().
+      if (!hashReported && (token == "isready" || token == "go"))
+      {
+          hashReported = true;
+          sync_cout << "info string " << TT.info() << sync_endl;
+      }
+
       if (    token == "quit"
           ||  token == "stop")
-          Threads.stop = true;
+          Threads.main()->stop_search();
 
       // The GUI sends 'ponderhit' to tell us the user has played the expected move.
       // So 'ponderhit' will be sent if we were told to ponder on the same move the
       // user has played. We should continue searching but switch from pondering to
       // normal search.
       else if (token == "ponderhit")
-          Threads.main()->ponder = false; // Switch to normal search
+          Threads.main()->ponderhit();
 
       else if (token == "uci")
           sync_cout << "id name " << engine_info(true)
@@ -303,8 +593,71 @@ void UCI::loop(int argc, char* argv[]) {
       // Additional custom non-UCI commands, mainly for debugging
       else if (token == "flip")  pos.flip();
       else if (token == "bench") bench(pos, is, states);
+      else if (token == "smpbench") smp_bench(pos, is, states);
+      else if (token == "hashbench") hash_bench(pos, is, states);
+      else if (token == "evalcheck") eval_check(pos, is, states);
       else if (token == "d")     sync_cout << pos << sync_endl;
+      else if (token == "savehash" || token == "loadhash")
+      {
+          string fname;
+          getline(is >> ws, fname); // File name may contain spaces
+          if (fname.empty())
+              fname = string(Options["Hash File"]);
+
+          if (token == "savehash")
+              TT.save(fname);
+          else
+              TT.load(fname);
+      }
       else if (token == "eval")  sync_cout << Eval::trace(pos) << sync_endl;
+      else if (token == "tt")
+      {
+          string sub;
+          if (is >> sub && sub == "stats")
+          {
+              string report = TT.stats(); // Waits for the search, before locking the output
+              sync_cout << report << sync_endl;
+          }
+          else
+              sync_cout << "Unknown command: " << cmd << sync_endl;
+      }
+      else if (token == "perceptron")
+      {
+          string sub;
+          is >> sub;
+          if (sub == "bench")
+              sync_cout << Search::Perceptron::bench() << sync_endl;
+          else if (sub == "train")
+              train_perceptron(pos, is, states);
+          else
+              sync_cout << "Unknown command: " << cmd << sync_endl;
+      }
+      else if (token == "exp")
+      {
+          string sub, arg;
+          vector<string> files;
+          int minDepth = 0;
+
+          is >> sub;
+          while (is >> arg)
+              if (arg == "mindepth")
+                  is >> minDepth;
+              else
+                  files.push_back(arg);
+
+          if (sub == "convert")
+              EXPconvert();
+          else if (sub == "compact")
+              EXPcompact(Depth(minDepth * ONE_PLY));
+          else if (sub == "merge" && files.size() >= 2)
+          {
+              string out = files.back();
+              files.pop_back();
+              EXPmerge(files, out, Depth(minDepth * ONE_PLY));
+          }
+          else
+              sync_cout << "Unknown command: " << cmd << sync_endl;
+      }
       else
           sync_cout << "Unknown command: " << cmd << sync_endl;
 
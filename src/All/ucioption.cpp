@@ -19,6 +19,7 @@
 */
 
 #include <cassert>
+#include <iostream>
 #include <ostream>
 #include <sstream>
 
@@ -27,6 +28,7 @@
 #include "thread.h"
 #include "tt.h"
 #include "uci.h"
+#include "uct.h"
 #include "syzygy/tbprobe.h"
 
 using std::string;
@@ -37,9 +39,22 @@ namespace UCI {
 
 /// 'On change' actions, triggered by an option's value change
 void on_clear_hash(const Option&) { Search::clear(); }
-void on_hash_size(const Option& o) { TT.resize(o); EXP.resize(0); EXPresize(); } //mcts kellykynyama
+void on_hash_size(const Option& o) {
+  TT.resize(o);
+  EXP.resize(0); //mcts kellykynyama
+  sync_cout << "info string " << TT.info() << sync_endl;
+}
+void on_exp_size(const Option& o) { MCTS.resize(o); }
+void on_tree_size(const Option& o) { UCT::SearchTree.resize(o); }
 void on_logger(const Option& o) { start_logger(o); }
+void on_save_hash(const Option&) { TT.save(Options["Hash File"]); }
+void on_load_hash(const Option&) { TT.load(Options["Hash File"]); }
 void on_threads(const Option& o) { Threads.set(o); }
+void on_thread_tables(const Option&) {
+  Threads.main()->wait_for_search_finished();
+  for (Thread* th : Threads)
+      th->resizeTables = true; // Each thread resizes its own before searching
+}
 void on_tb_path(const Option& o) { Tablebases::init(o); }
 
 
@@ -58,13 +73,27 @@ void init(OptionsMap& o) {
   // at most 2^32 clusters.
   constexpr int MaxHashMB = Is64Bit ? 131072 : 2048;
 
+  // Per-thread pawn and material tables, in kilobytes, of 32768 and 8192 entries
+  constexpr int PawnHashKB     = 32768 * sizeof(Pawns::Entry) / 1024;
+  constexpr int MaterialHashKB =  8192 * sizeof(Material::Entry) / 1024;
+
   o["Debug Log File"]              << Option("", on_logger);
   o["Analysis Contempt"]     	   << Option("Both var Off var White var Black var Both", "Both");
   o["Threads"]               	   << Option(1, 1, 512, on_threads);
+  o["SMP Skip Blocks"]             << Option(false);
+  o["SMP Busy Marks"]              << Option(false);
   o["Hash"]                  	   << Option(16, 1, MaxHashMB, on_hash_size);
+  o["Eval Cache"]                  << Option(1, 0, 1024, on_thread_tables);
+  o["Pawn Hash"]                   << Option(PawnHashKB, 1, 1048576, on_thread_tables);
+  o["Material Hash"]               << Option(MaterialHashKB, 1, 1048576, on_thread_tables);
   o["Clear Hash"]            	   << Option(on_clear_hash);
+  o["Never Clear Hash"]            << Option(false);
+  o["Hash File"]                   << Option("hash.hsh");
+  o["Save Hash to File"]           << Option(on_save_hash);
+  o["Load Hash from File"]         << Option(on_load_hash);
   o["Ponder"]                	   << Option(false);
   o["MultiPV"]               	   << Option(1, 1, 500);
+  o["MultiPV Split"]               << Option(false);
   o["Move Overhead"]         	   << Option(30, 0, 5000);
   o["Slow Mover"]            	   << Option(84, 10, 1000);
   o["UCI_Chess960"]          	   << Option(false);
@@ -78,7 +107,11 @@ void init(OptionsMap& o) {
   o["Less Pruning Mode"]    	   << Option(0, 0,  9);
   o["Variety"]                     << Option (0, 0, 40);
   o["NN Perceptron Search"]  	   << Option(false);
+  o["NN Parallel Playouts"]        << Option(false);
+  o["NN MCTS Search"]              << Option(false);
+  o["MCTS Tree Size"]              << Option(64, 1, MaxHashMB, on_tree_size);
   o["NN Persisted Self-Learning"]  << Option(false);
+  o["Experience Size"]             << Option(64, 1, MaxHashMB, on_exp_size);
   o["Tal"]                         << Option(false);
   o["Capablanca"]            	   << Option(false);
   o["Petrosian"]                   << Option(false);
@@ -0,0 +1,191 @@
+/*
+  ShashChess, a UCI chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  ShashChess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  ShashChess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>   // For std::memset
+#include <iostream>
+
+#include "thread.h"
+#include "uct.h"
+
+namespace UCT {
+
+Tree SearchTree; // Our global search tree
+
+
+/// Edge::q() returns the mean score of the edge, counting each virtual loss as
+/// a lost playout, or fpu (first play urgency) if the edge was never visited.
+
+double Edge::q(double fpu) const {
+
+  uint32_t n = visits.load(std::memory_order_relaxed)
+             + virtualLoss.load(std::memory_order_relaxed);
+
+  return n ? double(score.load(std::memory_order_relaxed)) / ScoreScale / n : fpu;
+}
+
+
+/// Tree::resize() sets the size of the tree in megabytes. The memory is only
+/// allocated by the first search in MCTS mode, so that it costs nothing when
+/// the mode is off.
+
+void Tree::resize(size_t mbSize) {
+
+  Threads.main()->wait_for_search_finished();
+
+  large_pages_free(mem, memSize, largePages);
+  mem = nullptr;
+  memSize = 0;
+  megabytes = mbSize;
+}
+
+
+/// Tree::clear() empties the tree, allocating it if needed. It is called by the
+/// main thread before the helper threads start searching. About EdgesPerNode
+/// edges are reserved for each node.
+
+void Tree::clear() {
+
+  if (!mem)
+  {
+      size_t bytes = std::max(size_t(1), megabytes) * 1024 * 1024;
+      nodeCount = bytes / (sizeof(Node) + EdgesPerNode * sizeof(Edge));
+      edgeCount = nodeCount * EdgesPerNode;
+      memSize = nodeCount * sizeof(Node) + edgeCount * sizeof(Edge);
+      mem = large_pages_alloc(memSize, largePages);
+
+      if (!mem)
+      {
+          std::cerr << "Failed to allocate " << megabytes
+                    << "MB for the search tree." << std::endl;
+          exit(EXIT_FAILURE);
+      }
+
+      nodes = static_cast<Node*>(mem);
+      edgePool = reinterpret_cast<Edge*>(nodes + nodeCount);
+  }
+
+  std::memset(static_cast<void*>(nodes), 0, nodeCount * sizeof(Node));
+  nodesUsed = edgesUsed = 0;
+}
+
+
+/// Tree::find() returns the node of the given position, or nullptr if the
+/// position is not in the tree.
+
+Node* Tree::find(Key key) const {
+
+  for (size_t i = index(key); ; i = (i + 1 == nodeCount ? 0 : i + 1))
+  {
+      Key k = nodes[i].key.load(std::memory_order_acquire);
+
+      if (k == key)
+          return &nodes[i];
+
+      if (!k)
+          return nullptr;
+  }
+}
+
+
+/// Tree::find_or_insert() returns the node of the given position, claiming an
+/// empty slot for it if it is not in the tree yet, and tells in found whether
+/// it was. It returns nullptr when the tree is full.
+
+Node* Tree::find_or_insert(Key key, bool& found) {
+
+  found = true;
+
+  if (Node* node = find(key))
+      return node;
+
+  found = false;
+
+  if (nodesUsed.load(std::memory_order_relaxed) * 100 >= nodeCount * MaxLoadPercent)
+      return nullptr;
+
+  for (size_t i = index(key); ; i = (i + 1 == nodeCount ? 0 : i + 1))
+  {
+      Key k = 0;
+
+      if (   nodes[i].key.compare_exchange_strong(k, key, std::memory_order_acq_rel)
+          || k == key)
+      {
+          if (!k)
+              nodesUsed.fetch_add(1, std::memory_order_relaxed);
+          else
+              found = true; // Inserted meanwhile by another thread
+
+          return &nodes[i];
+      }
+  }
+}
+
+
+/// Tree::new_edges() hands out count edges of the pool to the node being
+/// expanded, or returns nullptr if the pool is exhausted.
+
+Edge* Tree::new_edges(Node* node, size_t count) {
+
+  size_t first = edgesUsed.fetch_add(count, std::memory_order_relaxed);
+
+  if (first + count > edgeCount)
+      return nullptr;
+
+  node->firstEdge = uint32_t(first);
+  node->edgeCount = uint32_t(count);
+  return edgePool + first;
+}
+
+
+/// Tree::hashfull() returns the occupation of the tree in permill, as the
+/// larger of the node table and the edge pool occupations.
+
+int Tree::hashfull() const {
+
+  size_t n = nodesUsed.load(std::memory_order_relaxed) * 1000 / nodeCount;
+  size_t e = std::min(edgesUsed.load(std::memory_order_relaxed), edgeCount) * 1000 / edgeCount;
+
+  return int(std::max(n, e));
+}
+
+
+/// to_score() converts a search value into the expected score of the side to
+/// move, with the usual logistic curve of 400 centipawns per factor of ten in
+/// the odds. to_value() is its inverse, clamped to the known win range.
+
+double to_score(Value v) {
+
+  double cp = double(v) * 100 / int(PawnValueEg);
+  return 1.0 / (1.0 + std::pow(10.0, -cp / 400));
+}
+
+Value to_value(double score) {
+
+  score = std::max(1e-6, std::min(score, 1.0 - 1e-6));
+  double cp = -400 * std::log10(1.0 / score - 1.0);
+  int v = int(cp * int(PawnValueEg) / 100);
+
+  return Value(std::max(-int(VALUE_KNOWN_WIN), std::min(v, int(VALUE_KNOWN_WIN))));
+}
+
+} // namespace UCT
@@ -0,0 +1,116 @@
+/*
+  ShashChess, a UCI chess playing engine derived from Stockfish
+  Copyright (C) 2004-2008 Tord Romstad (Glaurung author)
+  Copyright (C) 2008-2015 Marco Costalba, Joona Kiiski, Tord Romstad
+  Copyright (C) 2015-2018 Marco Costalba, Joona Kiiski, Gary Linscott, Tord Romstad
+
+  ShashChess is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  ShashChess is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef UCT_H_INCLUDED
+#define UCT_H_INCLUDED
+
+#include <atomic>
+#include <cstddef>
+
+#include "misc.h"
+#include "types.h"
+
+namespace UCT {
+
+/// Edge is a move of a node of the search tree, in 24 bytes. Its statistics are
+/// updated by all the search threads without locking. The score is the sum of
+/// the results of the playouts through the edge, in [0, 1] from the point of
+/// view of the side making the move, scaled by ScoreScale to be added atomically.
+/// It is 64 bits wide, as 32 bits would wrap after 2^24 playouts through a root
+/// edge, a few minutes of analysis.
+/// A thread going through an edge adds a virtual loss to it until its playout is
+/// backed up, so that the other threads prefer different lines meanwhile.
+
+struct Edge {
+
+  static constexpr int ScoreScale = 1 << 8;
+
+  Move move() const { return Move(move16); }
+  double q(double fpu) const;
+
+  uint16_t move16;
+  std::atomic<uint16_t> virtualLoss;
+  float prior;
+  std::atomic<uint32_t> visits;
+  std::atomic<uint64_t> score;
+};
+
+static_assert(sizeof(Edge) == 24, "Edge size incorrect");
+
+/// Node is a position of the search tree, keyed by the full 64 bit position key
+/// so that transpositions share their statistics. A node is inserted Empty by
+/// the first playout reaching it, which evaluates it as a leaf, and expanded by
+/// the next one. Meanwhile it is Expanding, and the other threads evaluate it
+/// as a leaf. An Expanded node without edges is a mate or stalemate.
+
+struct Node {
+
+  enum State : uint32_t { Empty, Expanding, Expanded };
+
+  std::atomic<Key> key;
+  std::atomic<uint32_t> state;
+  std::atomic<uint32_t> visits;
+  uint32_t firstEdge;
+  uint32_t edgeCount;
+};
+
+/// Tree is the search tree of the "NN MCTS Search" mode, sized by the "MCTS Tree
+/// Size" option. The nodes are stored in an open addressing hash table with
+/// linear probing, and the edges in a pool handed out sequentially. Both are
+/// lock-free: a slot is claimed by a compare and swap of its key, and a range of
+/// edges by an atomic add. The tree is emptied before each search, and allocated
+/// by the first one.
+
+class Tree {
+
+  static constexpr int EdgesPerNode = 8; // Average, as most nodes are leaves
+  static constexpr int MaxLoadPercent = 90;
+
+public:
+ ~Tree() { large_pages_free(mem, memSize, largePages); }
+  void resize(size_t mbSize);
+  void clear();
+  Node* find(Key key) const;
+  Node* find_or_insert(Key key, bool& found);
+  Edge* new_edges(Node* node, size_t count);
+  Edge* edges(const Node* node) const { return edgePool + node->firstEdge; }
+  int hashfull() const;
+
+private:
+  size_t index(Key key) const { return (uint32_t(key) * uint64_t(nodeCount)) >> 32; }
+
+  size_t megabytes = 0, nodeCount = 0, edgeCount = 0, memSize = 0;
+  Node* nodes = nullptr;
+  Edge* edgePool = nullptr;
+  std::atomic<size_t> nodesUsed, edgesUsed;
+  void* mem = nullptr;
+  LargePages largePages = NO_LARGE_PAGES;
+};
+
+/// Conversions between search values and the [0, 1] scores of the tree
+double to_score(Value v);
+Value to_value(double score);
+
+extern Tree SearchTree;
+
+} // namespace UCT
+
+#endif // #ifndef UCT_H_INCLUDED